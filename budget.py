@@ -0,0 +1,178 @@
+#!/usr/bin/python3
+
+# Reports the RAM and flash used by each part of the firmware from the linker
+# map and fails the build when a budget is exceeded
+#
+# run by PlatformIO after every link (extra_scripts = post:budget.py in
+# platformio.ini), or by hand on a map file:
+#
+#   budget.py .pio/build/teensylc/firmware.map
+#
+# RAM is .data and .bss, flash is code, constants and the initial values of
+# .data. The stack grows down from the top of RAM into whatever is left, so
+# STACK_RESERVE of it is kept free.
+
+import os
+import re
+import sys
+
+# Teensy LC, used when the map has no memory configuration
+FLASH_REGION = (0x00000000, 62 * 1024)
+RAM_REGION = (0x1FFFF800, 8 * 1024)
+
+STACK_RESERVE = 1024
+
+# object files (without .o) to subsystem, anything else is the core
+# libraries (Teensy core, libc, libgcc)
+SUBSYSTEMS = {
+    "terminal.cpp": "terminal",
+    "glyphs.cpp": "glyphs",
+    "keyboard.cpp": "keyboard",
+    "GSL1680.cpp": "touch",
+    "touchcal.cpp": "touch",
+    "tinyflash.cpp": "flash",
+    "flashprog.cpp": "flash",
+    "flightrec.cpp": "flightrec",
+    "RA8875.cpp": "display",
+}
+
+# (flash, ram) budget of each subsystem in bytes, None is only reported
+BUDGETS = {
+    "terminal": (24 * 1024, 5632),
+    "glyphs": (2048, 64),
+    "keyboard": (1024, 64),
+    "touch": (4096, 256),
+    "flash": (2048, 384),
+    "flightrec": (2048, 640),
+    "display": (16 * 1024, 128),
+    "core": (None, None),
+}
+
+SKIP_SECTIONS = (".debug", ".comment", ".ARM.attributes", ".stab")
+RAM_ONLY_SECTIONS = (".bss", ".noinit", "COMMON")
+
+
+def subsystem(obj):
+    # archive members look like path/libFoo.a(bar.cpp.o)
+    m = re.search(r"\(([^)]+)\)$", obj)
+    name = os.path.basename(m.group(1) if m else obj)
+    if name.endswith(".o"):
+        name = name[:-2]
+    return SUBSYSTEMS.get(name, "core")
+
+
+def read_regions(lines):
+    flash, ram = FLASH_REGION, RAM_REGION
+    for line in lines:
+        if line.startswith("Linker script and memory map"):
+            break
+        f = line.split()
+        if len(f) >= 3 and f[1].startswith("0x") and f[2].startswith("0x"):
+            region = (int(f[1], 16), int(f[2], 16))
+            if f[0].upper() == "FLASH":
+                flash = region
+            elif f[0].upper() == "RAM":
+                ram = region
+    return flash, ram
+
+
+def inside(region, addr):
+    return region[0] <= addr < region[0] + region[1]
+
+
+def parse_map(fn):
+    with open(fn) as f:
+        lines = f.read().splitlines()
+
+    flash_region, ram_region = read_regions(lines)
+    usage = {}
+
+    def add(name, output, section, addr, size, obj):
+        if size == 0 or output.startswith(SKIP_SECTIONS):
+            return
+        u = usage.setdefault(subsystem(obj), [0, 0])
+        if inside(ram_region, addr):
+            u[1] += size
+            # initialised data is copied from flash at startup
+            if not section.startswith(RAM_ONLY_SECTIONS) and not output.startswith(RAM_ONLY_SECTIONS):
+                u[0] += size
+        elif inside(flash_region, addr):
+            u[0] += size
+
+    # skip the discarded sections listed before the memory map
+    try:
+        start = lines.index("Linker script and memory map") + 1
+    except ValueError:
+        sys.exit("{}: not a GNU ld map file".format(fn))
+
+    output = ""
+    pending = None
+    for line in lines[start:]:
+        m = re.match(r"^(\.\S+|\S+)\s*", line)
+        if m and not line.startswith(" "):
+            output = m.group(1)
+            pending = None
+            continue
+        # input section, on one line or with the name on a line of its own
+        m = re.match(r"^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$", line)
+        if m:
+            add(m.group(1), output, m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4))
+            pending = None
+            continue
+        m = re.match(r"^ (\S+)$", line)
+        if m:
+            pending = m.group(1)
+            continue
+        m = re.match(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$", line)
+        if m and pending:
+            add(pending, output, pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3))
+        pending = None
+
+    return usage, flash_region[1], ram_region[1]
+
+
+def report(fn):
+    usage, flash_size, ram_size = parse_map(fn)
+    failed = []
+
+    print("{:<10} {:>8} {:>8} {:>8} {:>8}".format("", "flash", "budget", "ram", "budget"))
+    for name in sorted(usage, key=lambda n: (n == "core", n)):
+        flash, ram = usage[name]
+        flash_budget, ram_budget = BUDGETS.get(name, (None, None))
+        print("{:<10} {:>8} {:>8} {:>8} {:>8}".format(name, flash, flash_budget or "-", ram, ram_budget or "-"))
+        if flash_budget is not None and flash > flash_budget:
+            failed.append("{} flash {} > {}".format(name, flash, flash_budget))
+        if ram_budget is not None and ram > ram_budget:
+            failed.append("{} ram {} > {}".format(name, ram, ram_budget))
+
+    flash = sum(u[0] for u in usage.values())
+    ram = sum(u[1] for u in usage.values())
+    print("{:<10} {:>8} {:>8} {:>8} {:>8}".format("total", flash, flash_size, ram, ram_size - STACK_RESERVE))
+    print("free: {} bytes flash, {} bytes ram for the stack".format(flash_size - flash, ram_size - ram))
+    if flash > flash_size:
+        failed.append("total flash {} > {}".format(flash, flash_size))
+    if ram > ram_size - STACK_RESERVE:
+        failed.append("total ram {} > {} (keeping {} for the stack)".format(ram, ram_size - STACK_RESERVE, STACK_RESERVE))
+
+    for f in failed:
+        print("Over budget: " + f)
+    return 1 if failed else 0
+
+
+try:
+    Import("env")
+except NameError:
+    env = None
+
+if env is not None:
+    map_file = os.path.join(env.subst("$BUILD_DIR"), "firmware.map")
+    env.Append(LINKFLAGS=["-Wl,-Map," + map_file])
+
+    def check_budget(source, target, env):
+        return report(map_file)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", check_budget)
+elif __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit("usage: budget.py firmware.map")
+    sys.exit(report(sys.argv[1]))
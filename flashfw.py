@@ -0,0 +1,110 @@
+#!/usr/bin/python3
+
+# Programs and verifies the terminal's W25Q80BV flash over USB serial
+# The terminal must be running a build with -DFLASHFW (or -DVERIFYFW to only verify/read)
+#
+#   flashfw.py image.bin              program image at address 0 and verify it
+#   flashfw.py -a 0x10000 fonts.bin   program at another (4K aligned) address
+#   flashfw.py --verify image.bin     just verify
+#   flashfw.py --read 0 4096 out.bin  dump flash contents
+
+import argparse
+import binascii
+import struct
+import sys
+import time
+import serial
+
+PAGE_SIZE = 256
+SECTOR_SIZE = 4096
+
+
+def status(ser):
+    s = ser.read(1)
+    if s != b"K":
+        raise IOError("command failed ({})".format(s))
+
+
+def identify(ser):
+    ser.write(b"I")
+    status(ser)
+    return struct.unpack("<I", ser.read(4))[0]
+
+
+def program(ser, addr, data):
+    # pad to whole pages, erased flash reads back as 0xFF
+    if len(data) % PAGE_SIZE:
+        data += b"\xFF" * (PAGE_SIZE - len(data) % PAGE_SIZE)
+
+    start = time.time()
+    for off in range(0, len(data), PAGE_SIZE):
+        page = data[off:off + PAGE_SIZE]
+        crc = binascii.crc32(page) & 0xFFFFFFFF
+        ser.write(b"W" + struct.pack("<I", addr + off) + page + struct.pack("<I", crc))
+        status(ser)
+        print("\r{}/{} bytes".format(off + PAGE_SIZE, len(data)), end="")
+    print(" in {:.1f}s".format(time.time() - start))
+
+
+def verify(ser, addr, data):
+    ser.write(b"C" + struct.pack("<II", addr, len(data)))
+    status(ser)
+    crc = struct.unpack("<I", ser.read(4))[0]
+    expected = binascii.crc32(data) & 0xFFFFFFFF
+    if crc != expected:
+        print("Verify FAILED: flash {:08X}, file {:08X}".format(crc, expected))
+        return False
+    print("Verify ok, crc {:08X}".format(crc))
+    return True
+
+
+def read(ser, addr, length):
+    ser.write(b"R" + struct.pack("<II", addr, length))
+    status(ser)
+    data = ser.read(length)
+    if len(data) != length:
+        raise IOError("short read {} of {}".format(len(data), length))
+    return data
+
+
+parser = argparse.ArgumentParser(description="Program the terminal flash")
+parser.add_argument("-p", "--port", default="/dev/ttyACM0", help="USB serial port of the terminal")
+parser.add_argument("-a", "--address", default="0", help="flash address, must be 4K aligned when programming")
+parser.add_argument("--verify", action="store_true", help="only verify the image")
+parser.add_argument("--read", nargs=3, metavar=("ADDR", "LEN", "FILE"), help="dump LEN bytes from ADDR to FILE")
+parser.add_argument("image", nargs="?", help="image file to program or verify")
+args = parser.parse_args()
+
+try:
+    ser = serial.Serial(args.port, timeout=5)
+except Exception as e:
+    print("Failed to open port: {}".format(e))
+    sys.exit(1)
+
+capacity = identify(ser)
+print("Flash capacity {} bytes".format(capacity))
+
+if args.read:
+    addr, length = int(args.read[0], 0), int(args.read[1], 0)
+    with open(args.read[2], "wb") as f:
+        f.write(read(ser, addr, length))
+    sys.exit(0)
+
+if args.image is None:
+    parser.error("an image file is required")
+
+addr = int(args.address, 0)
+with open(args.image, "rb") as f:
+    data = f.read()
+
+if addr + len(data) > capacity:
+    print("Image does not fit in flash")
+    sys.exit(1)
+
+if not args.verify:
+    if addr % SECTOR_SIZE:
+        print("Address must be 4K aligned")
+        sys.exit(1)
+    program(ser, addr, data)
+
+sys.exit(0 if verify(ser, addr, data) else 1)
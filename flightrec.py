@@ -0,0 +1,126 @@
+#!/usr/bin/python3
+
+# Extracts the flight recorder log (-DFLIGHTREC) from the terminal's flash
+# The terminal must be running a build with -DVERIFYFW, which can read the
+# flash but never writes it, so the log is left as it was
+#
+#   flightrec.py log.bin                     save the recorded host output
+#   flightrec.py --list log.bin              also show each page with its time
+#   flightrec.py --image dump.bin log.bin    use a dump from flashfw.py --read
+#   flightrec.py --replay /dev/ttyUSB0       send the log to a terminal to see it
+#                                            again, at the recorded pace with --timed
+
+import argparse
+import struct
+import sys
+import time
+import serial
+
+PAGE_SIZE = 256
+SECTOR_SIZE = 4096
+FLIGHTREC_START = 0x10000
+FLIGHTREC_MAGIC = 0x5246
+HEADER = struct.Struct("<HHIII")
+READ_CHUNK = 65536
+
+
+def status(ser):
+    s = ser.read(1)
+    if s != b"K":
+        raise IOError("command failed ({})".format(s))
+
+
+def identify(ser):
+    ser.write(b"I")
+    status(ser)
+    return struct.unpack("<I", ser.read(4))[0]
+
+
+def read(ser, addr, length):
+    ser.write(b"R" + struct.pack("<II", addr, length))
+    status(ser)
+    data = ser.read(length)
+    if len(data) != length:
+        raise IOError("short read {} of {}".format(len(data), length))
+    return data
+
+
+def read_log(port):
+    ser = serial.Serial(port, timeout=10)
+    end = identify(ser) & ~(SECTOR_SIZE - 1)
+    data = b""
+    for addr in range(FLIGHTREC_START, end, READ_CHUNK):
+        data += read(ser, addr, min(READ_CHUNK, end - addr))
+        print("\rread {}/{} bytes".format(len(data), end - FLIGHTREC_START), end="", file=sys.stderr)
+    print(file=sys.stderr)
+    return data
+
+
+# valid pages in sequence order, each (seq, time, dropped, data)
+def parse(region):
+    pages = []
+    for off in range(0, len(region) - PAGE_SIZE + 1, PAGE_SIZE):
+        magic, length, seq, ms, dropped = HEADER.unpack_from(region, off)
+        if magic != FLIGHTREC_MAGIC or length > PAGE_SIZE - HEADER.size:
+            continue
+        start = off + HEADER.size
+        pages.append((seq, ms, dropped, region[start:start + length]))
+    pages.sort()
+    return pages
+
+
+def replay(port, baud, pages, timed):
+    ser = serial.Serial(port, baudrate=baud)
+    last = None
+    for seq, ms, dropped, data in pages:
+        if timed and last is not None and ms > last:
+            time.sleep((ms - last) / 1000.0)
+        last = ms
+        ser.write(data)
+    ser.flush()
+
+
+parser = argparse.ArgumentParser(description="Extract the terminal flight recorder log")
+parser.add_argument("-p", "--port", default="/dev/ttyACM0", help="USB serial port of the terminal")
+parser.add_argument("--image", help="read the log from a flash dump (from address 0) instead of the terminal")
+parser.add_argument("--list", action="store_true", help="list the pages with their time and dropped bytes")
+parser.add_argument("--replay", metavar="PORT", help="send the log to a terminal on this serial port")
+parser.add_argument("--baud", type=int, default=115200, help="baud rate for --replay")
+parser.add_argument("--timed", action="store_true", help="replay at the recorded pace rather than flat out")
+parser.add_argument("log", nargs="?", help="file to save the recorded host output in")
+args = parser.parse_args()
+
+if args.image:
+    with open(args.image, "rb") as f:
+        region = f.read()[FLIGHTREC_START:]
+else:
+    try:
+        region = read_log(args.port)
+    except Exception as e:
+        print("Failed to read the log: {}".format(e))
+        sys.exit(1)
+
+pages = parse(region)
+if not pages:
+    print("No log found")
+    sys.exit(1)
+
+total = sum(len(p[3]) for p in pages)
+print("{} pages, {} bytes, {} dropped since the last boot, {:.1f}s recorded".format(
+    len(pages), total, pages[-1][2], (pages[-1][1] - pages[0][1]) / 1000.0))
+
+prev = None
+for seq, ms, dropped, data in pages:
+    if prev is not None and seq != prev + 1:
+        print("gap after page {}".format(prev))
+    prev = seq
+    if args.list:
+        print("{:8d} {:10.3f}s {:4d} bytes {} dropped".format(seq, ms / 1000.0, len(data), dropped))
+
+if args.log:
+    with open(args.log, "wb") as f:
+        for p in pages:
+            f.write(p[3])
+
+if args.replay:
+    replay(args.replay, args.baud, pages, args.timed)
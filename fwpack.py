@@ -0,0 +1,88 @@
+#!/usr/bin/python3
+
+# Converts the GSL1680 touch firmware into the packed image loaded from the
+# W25Q80BV flash by load_touch_fw()
+#
+# input is either the vendor C source array, lines like {0xf0,0x3},{0x00,0xa5a5ffc0},
+# or (with --legacy) the old flash image of 8 byte records (addr, 3 pad bytes, 4 data bytes)
+#
+# packed image, all little endian:
+#   header: magic "GSLP", u16 version, u16 number of runs, u32 length of runs,
+#           u32 crc32 of the 12 header bytes before it and the runs
+#   runs:   u8 start register, u8 byte count, data...
+
+import argparse
+import binascii
+import re
+import struct
+import sys
+
+MAGIC = b"GSLP"
+VERSION = 1
+PAGE_REG = 0xf0
+PAGE_WINDOW = 0x80
+
+
+def read_source(fn):
+    with open(fn) as f:
+        text = f.read()
+    # skip comments so commented out records are not picked up
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    text = re.sub(r"//.*", "", text)
+    recs = []
+    for m in re.finditer(r"\{\s*(0[xX][0-9a-fA-F]+|\d+)\s*,\s*(0[xX][0-9a-fA-F]+|\d+)\s*\}", text):
+        recs.append((int(m.group(1), 0), int(m.group(2), 0)))
+    return recs
+
+
+def read_legacy(fn):
+    with open(fn, "rb") as f:
+        data = f.read()
+    recs = []
+    for i in range(0, len(data) - 7, 8):
+        addr, val = struct.unpack_from("<II", data, i)
+        recs.append((addr & 0xFF, val))
+    return recs
+
+
+def pack(recs):
+    runs = []
+    reg = None
+    buf = b""
+    for addr, val in recs:
+        if reg is not None and (addr != reg + len(buf) or addr == PAGE_REG or reg == PAGE_REG):
+            runs.append((reg, buf))
+            reg = None
+        if reg is None:
+            reg = addr
+            buf = b""
+        buf += struct.pack("<I", val)
+        # runs never cross the page window
+        if addr + 4 >= PAGE_WINDOW:
+            runs.append((reg, buf))
+            reg = None
+    if reg is not None:
+        runs.append((reg, buf))
+
+    body = b"".join(struct.pack("<BB", r, len(b)) + b for r, b in runs)
+    head = struct.pack("<4sHHI", MAGIC, VERSION, len(runs), len(body))
+    crc = binascii.crc32(head + body) & 0xFFFFFFFF
+    return head + struct.pack("<I", crc) + body, len(runs)
+
+
+parser = argparse.ArgumentParser(description="Pack GSL1680 firmware for the terminal flash")
+parser.add_argument("input", help="vendor firmware source (.h) or legacy image with --legacy")
+parser.add_argument("output", help="packed image to write")
+parser.add_argument("-l", "--legacy", action="store_true", help="input is a legacy 8 byte record image")
+args = parser.parse_args()
+
+recs = read_legacy(args.input) if args.legacy else read_source(args.input)
+if len(recs) == 0:
+    print("No firmware records found in {}".format(args.input))
+    sys.exit(1)
+
+image, nruns = pack(recs)
+with open(args.output, "wb") as f:
+    f.write(image)
+
+print("{} records -> {} runs, {} bytes (was {} bytes)".format(len(recs), nruns, len(image), len(recs) * 8))
@@ -37,6 +37,12 @@ pin | function  | Teensy LC
 
 #define delayus delayMicroseconds
 
+// I2C clock, the GSL1680 supports fast mode
+#define GSL_I2C_CLOCK		400000
+
+// longest burst we can send, the Wire buffer also has to hold the register byte
+#define FW_BURST_MAX		(((BUFFER_LENGTH - 1) / 4) * 4)
+
 struct _coord { uint32_t x, y; uint8_t finger; };
 
 struct _ts_event {
@@ -163,7 +169,14 @@ void init_chip()
 	digitalWrite(WAKE, HIGH);
 	delay(30);
 
-	delay(500);
+	// rather than a fixed 500ms wait for the chip to come up, poll until it
+	// acknowledges its address
+	uint32_t start = millis();
+	while(millis() - start < 500) {
+		Wire.beginTransmission(GSLX680_I2C_ADDR);
+		if(Wire.endTransmission() == 0) break;
+		delay(5);
+	}
 
 	// CTP startup sequence
 	clr_reg();
@@ -199,24 +212,82 @@ bool is_fw_loaded()
     return (buf[0] == 0x00 && buf[1] == 0x00 && buf[2] == 0x00 && buf[3] == 0x01);
 }
 
+// Firmware records are a register and 4 bytes of data, consecutive records
+// almost always target sequential registers within the current page so they
+// are coalesced into one burst write. A page select (0xf0) always ends a burst.
+static uint8_t fw_burst[FW_BURST_MAX];
+static uint8_t fw_burst_reg;
+static uint8_t fw_burst_len = 0;
+
+static void gsl_load_fw_flush()
+{
+	if(fw_burst_len > 0) {
+		i2c_write(fw_burst_reg, fw_burst, fw_burst_len);
+		fw_burst_len = 0;
+	}
+}
+
 void gsl_load_fw(uint8_t addr, uint8_t Wrbuf[4])
 {
-	i2c_write(addr, Wrbuf, 4);
+	if(fw_burst_len > 0 && (addr != fw_burst_reg + fw_burst_len || fw_burst_len + 4 > FW_BURST_MAX)) {
+		gsl_load_fw_flush();
+	}
+
+	if(fw_burst_len == 0) fw_burst_reg = addr;
+	memcpy(&fw_burst[fw_burst_len], Wrbuf, 4);
+	fw_burst_len += 4;
+
+	// the page register must be written on its own, as must anything that
+	// would run off the end of the 128 byte page window
+	if(addr == GSL_PAGE_REG || addr + 4 >= 0x80) {
+		gsl_load_fw_flush();
+	}
+}
+
+// write a run of sequential registers from the packed firmware format,
+// runs never cross the 128 byte page window
+void gsl_load_fw_run(uint8_t reg, uint8_t *data, uint8_t len)
+{
+	gsl_load_fw_flush();
+	while(len > 0) {
+		uint8_t n = len > FW_BURST_MAX ? FW_BURST_MAX : len;
+		i2c_write(reg, data, n);
+		reg += n;
+		data += n;
+		len -= n;
+	}
 }
 
 void gsl_final_setup()
 {
+	gsl_load_fw_flush();
 	reset_chip();
 	startup_chip();
 }
 
-extern "C" void add_touch_event(struct _ts_event*);
+// The interrupt only flags that the controller has data, the I2C read itself is
+// a blocking 24 byte transaction so it is done from loop() via gsl_poll()
+static volatile bool touch_pending = false;
+
 void handle_read_irq()
 {
+    touch_pending = true;
+}
+
+extern "C" void add_touch_event(struct _ts_event*);
+// call from the main loop, reads any pending touch report and queues it
+// returns true if a report was read
+bool gsl_poll()
+{
+    if(!touch_pending) return false;
+
+    touch_pending = false;
     int n = read_data();
     if(n >= 0) {
         add_touch_event(&ts_event);
     }
+
+    return n >= 0;
 }
 
 void gsl_setup()
@@ -227,6 +298,7 @@ void gsl_setup()
 	attachInterrupt(digitalPinToInterrupt(INTRPT), handle_read_irq, FALLING);
 	delay(100);
 	Wire.begin();
+	Wire.setClock(GSL_I2C_CLOCK);
 	init_chip();
 
 #if 0
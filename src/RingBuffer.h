@@ -3,7 +3,8 @@
 //  Manage objects by value.
 //  Thread safe for single Producer and single Consumer.
 //  By Dennis Lang http://home.comcast.net/~lang.dennis/code/ring/ring.html
-//  Slightly modified for naming
+//  Slightly modified for naming, and the storage is part of the object so
+//  nothing is allocated at run time
 
 #pragma once
 
@@ -20,26 +21,11 @@ class RingBuffer
          */
         RingBuffer()
         {
-            size = length;
             tail = 0;
             head = 0;
-            buffer = (kind*) malloc(sizeof(kind) * size);
             overflow= 0;
         }
 
-        /**
-         * @brief   Deinitialize ringbuffer
-         * @param   Nothing
-         * @return  Nothing
-         * @note    Deallocates the buffer from memory
-         */
-        ~RingBuffer()
-        {
-            free(buffer);
-        }
-
-        bool is_ok() const { return buffer != nullptr; }
-
         /**
          * @brief   Get next index of the reference index
          * @param   Reference index
@@ -48,7 +34,7 @@ class RingBuffer
          */
         size_t next(size_t n) const
         {
-            return (n + 1) % size;
+            return (n + 1) % length;
         }
 
         /**
@@ -80,7 +66,7 @@ class RingBuffer
          */
         size_t get_size() const
         {
-            return (tail > head ? size : 0) + head - tail;
+            return (tail > head ? length : 0) + head - tail;
         }
 
         /**
@@ -117,12 +103,55 @@ class RingBuffer
             return buffer[tail];
         }
 
+        /**
+         * @brief   Get the objects from the tail position that are contiguous in memory
+         * @param   Set to the number of objects available at the returned pointer
+         * @return  Pointer to the oldest object
+         * @note    The objects stay in the buffer until consume() is called
+         */
+        const kind *front_span(size_t& n) const
+        {
+            n = (head >= tail ? head : length) - tail;
+            return &buffer[tail];
+        }
+
+        /**
+         * @brief   Remove objects from the tail position
+         * @param   Number of objects to remove, at most what front_span() returned
+         * @return  Nothing
+         */
+        void consume(size_t n)
+        {
+            tail = (tail + n) % length;
+        }
+
+        /**
+         * @brief   Get the free space from the head position that is contiguous in memory
+         * @param   Set to the number of objects that can be stored at the returned pointer
+         * @return  Pointer to where the next object goes
+         * @note    The objects are only in the buffer once commit() is called
+         */
+        kind *back_span(size_t& n)
+        {
+            n = tail > head ? tail - head - 1 : length - head - (tail == 0 ? 1 : 0);
+            return &buffer[head];
+        }
+
+        /**
+         * @brief   Add objects written to the space from back_span()
+         * @param   Number of objects to add, at most what back_span() returned
+         * @return  Nothing
+         */
+        void commit(size_t n)
+        {
+            head = (head + n) % length;
+        }
+
         size_t get_overflow() const { return overflow; }
 
     private:
-        kind *buffer;
+        kind buffer[length];
         size_t tail;   //Pointer to the oldest object
         size_t head;   //Pointer to the newest object
-        size_t size;   //Fixed size of the buffer
         size_t overflow;
 };
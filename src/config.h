@@ -0,0 +1,43 @@
+// Sizes of every statically allocated buffer, in one place so the RAM
+// budget can be traded between them. Each can be overridden from
+// build_flags in platformio.ini, budget.py reports what the build uses.
+// The Teensy LC has 8K of RAM, the stack and the core libraries need
+// about 1.5K of that.
+
+#pragma once
+
+// screen text, one byte per cell, 100x30 (landscape) and 60x50 (portrait)
+// at font scale 0
+#ifndef MAX_CELLS
+#define MAX_CELLS 3000
+#endif
+#ifndef MAX_ROWS
+#define MAX_ROWS 50
+#endif
+
+// host ports, SPLIT shows a second one (Serial3) in its own pane
+#ifdef SPLIT
+#define SESSIONS 2
+#else
+#define SESSIONS 1
+#endif
+
+// host output waiting to be parsed for each session, about 90ms at
+// 115200 baud, half that each when split
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE (1024 / SESSIONS)
+#endif
+
+// main screen text kept while the alternate screen is up
+#ifndef MAIN_CELLS_SIZE
+#define MAIN_CELLS_SIZE 1024
+#endif
+
+// touch reports waiting for loop(), 6 bytes each
+#ifndef TOUCH_EVENTS_SIZE
+#define TOUCH_EVENTS_SIZE 16
+#endif
+
+#if MAX_CELLS > 65535
+#error "reflow keeps cell offsets in 16 bits"
+#endif
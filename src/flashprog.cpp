@@ -0,0 +1,144 @@
+// Programs and verifies the W25Q80BV flash over the USB serial port,
+// talks to flashfw.py on the host.
+// Built with -DFLASHFW (or -DVERIFYFW which refuses all writes)
+
+/*
+Protocol, all values little endian, every command gets a one byte 'K' (ok)
+or 'N' (failed) status back, followed by any reply data.
+
+cmd | args                           | reply after status
+--------------------------------------------------------------------
+I   |                                | u32 capacity
+W   | u32 addr, 256 bytes, u32 crc32 |
+C   | u32 addr, u32 len              | u32 crc32 of the flash contents
+R   | u32 addr, u32 len              | len bytes of flash contents
+E   |                                |
+
+W writes one page, pages must be written in order from the start of each
+4K sector as the sector is erased when its first page arrives. The erase
+is started before the page data is read from USB, and the page program is
+started before the status is sent, so the flash is busy while the host
+is sending the next page. Any command reaching past the end of the flash
+fails.
+*/
+
+#include "tinyflash.h"
+#if defined(FLASHFW) || defined(VERIFYFW)
+#include "crc32.h"
+
+#define PAGE_SIZE 256
+#define SECTOR_SIZE 4096
+
+extern TinyFlash flash;
+
+static uint8_t page[PAGE_SIZE];
+
+static bool read_bytes(uint8_t *buf, size_t len)
+{
+    return Serial.readBytes((char *)buf, len) == len;
+}
+
+static bool read_u32(uint32_t& v)
+{
+    uint8_t b[4];
+    if(!read_bytes(b, 4)) return false;
+    v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+}
+
+static void write_u32(uint32_t v)
+{
+    uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+    Serial.write(b, 4);
+}
+
+static void status(bool ok)
+{
+    Serial.write(ok ? 'K' : 'N');
+}
+
+static bool write_page(uint32_t addr, uint32_t capacity)
+{
+    // wait for the previous page or erase to finish, the page must be
+    // aligned and all of it in the flash
+    bool ok = flash.waitForReady(1000L) && (addr % PAGE_SIZE) == 0 && capacity >= PAGE_SIZE && addr <= capacity - PAGE_SIZE;
+#ifdef VERIFYFW
+    ok = false;
+#endif
+    if(ok && (addr % SECTOR_SIZE) == 0) {
+        // erase while the page data is still arriving
+        ok = flash.startEraseSector(addr);
+    }
+
+    // always consume the page so we stay in step with the host
+    uint32_t crc;
+    if(!read_bytes(page, PAGE_SIZE) || !read_u32(crc)) return false;
+    if(!ok || crc != crc32_update(0, page, PAGE_SIZE)) return false;
+
+    // erase takes up to 400ms, then the page programs while we get the next one
+    return flash.waitForReady(1000L) && flash.startWritePage(addr, page);
+}
+
+static bool check_region(uint32_t addr, uint32_t len, bool send)
+{
+    if(!flash.waitForReady(1000L)) return false;
+
+    uint32_t crc = 0;
+    while(len > 0) {
+        uint32_t n = len > PAGE_SIZE ? PAGE_SIZE : len;
+        if(!flash.read(addr, page, n)) return false;
+        if(send) Serial.write(page, n);
+        else crc = crc32_update(crc, page, n);
+        addr += n;
+        len -= n;
+    }
+    if(!send) write_u32(crc);
+    return true;
+}
+
+// never returns
+void flash_programmer(uint32_t capacity)
+{
+    Serial.begin(115200);
+    Serial.setTimeout(1000);
+
+    while(true) {
+        if(!Serial.available()) continue;
+
+        char c = Serial.read();
+        uint32_t addr, len;
+        switch(c) {
+            case 'I':
+                status(capacity > 0);
+                write_u32(capacity);
+                break;
+
+            case 'W':
+                if(!read_u32(addr)) break;
+                status(write_page(addr, capacity));
+                break;
+
+            case 'C':
+            case 'R':
+                if(!read_u32(addr) || !read_u32(len)) break;
+                // written so that addr + len cannot overflow
+                if(capacity == 0 || len > capacity || addr > capacity - len) {
+                    status(false);
+                    break;
+                }
+                // status first, the reply follows
+                status(true);
+                check_region(addr, len, c == 'R');
+                break;
+
+            case 'E':
+#ifdef VERIFYFW
+                status(false);
+#else
+                status(flash.eraseChip());
+#endif
+                break;
+        }
+    }
+}
+#endif
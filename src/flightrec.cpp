@@ -0,0 +1,177 @@
+// Flight recorder, keeps the raw bytes received from the host in a circular
+// log in the W25Q80BV so whatever a field unit was sent can be replayed.
+// Built with -DFLIGHTREC, read back with flightrec.py and a -DVERIFYFW build.
+
+/*
+The log runs from FLIGHTREC_START (the touch firmware is below it) to the
+end of the flash in 256 byte pages:
+
+offset | size | field
+-------------------------------------------------------------
+0      | u16  | magic 'FR'
+2      | u16  | number of data bytes used
+4      | u32  | sequence number, one more than the previous page
+8      | u32  | millis() when the first byte arrived
+12     | u32  | bytes dropped so far as no page was free
+16     | 240  | data
+
+Bytes are collected in two RAM pages, and a page is written once it is
+full or the host has been quiet for FLIGHTREC_IDLE_MS. Writes and erases
+are only ever started, never waited for, from flightrec_poll(). When
+writing moves into a sector the next one is erased at the first moment no
+page is waiting, so it is ready long before it is needed. If input keeps
+pages waiting until writing reaches a sector whose erase has not started,
+that erase goes first and the pages wait for it. If both pages
+are full when a byte arrives the byte is counted and dropped rather than
+holding up the UART.
+*/
+
+#include "tinyflash.h"
+#ifdef FLIGHTREC
+
+#define PAGE_SIZE 256
+#define SECTOR_SIZE 4096
+#define FLIGHTREC_START 0x10000
+#define FLIGHTREC_MAGIC 0x5246
+#define FLIGHTREC_IDLE_MS 2000
+
+extern TinyFlash flash;
+
+struct flightrec_header_t {
+    uint16_t magic;
+    uint16_t len;
+    uint32_t seq;
+    uint32_t time;
+    uint32_t dropped;
+};
+
+#define FLIGHTREC_DATA (PAGE_SIZE - sizeof(flightrec_header_t))
+
+struct flightrec_page_t {
+    flightrec_header_t h;
+    uint8_t data[FLIGHTREC_DATA];
+};
+
+static flightrec_page_t pages[2];
+static bool ready[2];           // page is waiting to be written
+static uint8_t fill = 0;        // page being filled
+static uint32_t next_addr, end_addr, next_seq, dropped;
+static uint32_t erase_addr;
+static bool erase_pending = false;
+static bool recording = false;
+static uint32_t last_byte;
+
+static uint32_t next_sector(uint32_t addr)
+{
+    addr += SECTOR_SIZE;
+    return addr >= end_addr ? FLIGHTREC_START : addr;
+}
+
+static bool read_header(uint32_t addr, flightrec_header_t& h)
+{
+    return flash.read(addr, (uint8_t *)&h, sizeof(h)) && h.magic == FLIGHTREC_MAGIC && h.len <= FLIGHTREC_DATA;
+}
+
+// carry on after the newest page in the log
+void flightrec_setup(uint32_t capacity)
+{
+    end_addr = capacity & ~(SECTOR_SIZE - 1);
+    if(end_addr < FLIGHTREC_START + 2 * SECTOR_SIZE) return;
+
+    // the sector holding the newest page has the highest sequence in its first page
+    flightrec_header_t h;
+    uint32_t last = 0;
+    bool found = false;
+    for (uint32_t addr = FLIGHTREC_START; addr < end_addr; addr += SECTOR_SIZE) {
+        if(read_header(addr, h) && (!found || h.seq > next_seq)) {
+            next_seq = h.seq;
+            last = addr;
+            found = true;
+        }
+    }
+
+    if(found) {
+        for (uint32_t addr = last + PAGE_SIZE; addr < last + SECTOR_SIZE; addr += PAGE_SIZE) {
+            if(!read_header(addr, h) || h.seq != next_seq + 1) break;
+            next_seq = h.seq;
+            last = addr;
+        }
+        ++next_seq;
+        next_addr = last + PAGE_SIZE;
+        if(next_addr >= end_addr) next_addr = FLIGHTREC_START;
+    } else {
+        next_seq = 0;
+        next_addr = FLIGHTREC_START;
+    }
+
+    // the rest of a sector that was being written is still erased, a fresh
+    // one is erased now, and the following one in the background
+    if((next_addr % SECTOR_SIZE) == 0 && !flash.eraseSector(next_addr)) return;
+    erase_addr = next_sector(next_addr & ~(SECTOR_SIZE - 1));
+    erase_pending = true;
+    recording = true;
+}
+
+static void page_done()
+{
+    ready[fill] = true;
+    if(!ready[fill ^ 1]) fill ^= 1;
+}
+
+// record a byte received from the host
+void flightrec_byte(uint8_t c)
+{
+    if(!recording) return;
+
+    flightrec_page_t& p = pages[fill];
+    if(ready[fill]) {
+        dropped++;
+        return;
+    }
+    if(p.h.len == 0) p.h.time = millis();
+    p.data[p.h.len++] = c;
+    last_byte = millis();
+    if(p.h.len == FLIGHTREC_DATA) page_done();
+}
+
+// start the next flash write or erase if the flash is free, call often
+void flightrec_poll()
+{
+    if(!recording || flash.isBusy()) return;
+
+    // hand over a part filled page once the host goes quiet
+    if(!ready[fill] && pages[fill].h.len > 0 && millis() - last_byte >= FLIGHTREC_IDLE_MS) page_done();
+
+    // the older page goes first
+    uint8_t out = ready[fill ^ 1] ? fill ^ 1 : fill;
+
+    // erase ahead while nothing is waiting, or now if writing has caught up,
+    // then the sector after it is the one to erase ahead
+    if(erase_pending && (!ready[out] || next_addr == erase_addr)) {
+        flash.startEraseSector(erase_addr);
+        if(next_addr == erase_addr) erase_addr = next_sector(erase_addr);
+        else erase_pending = false;
+        return;
+    }
+    if(!ready[out]) return;
+
+    flightrec_page_t& p = pages[out];
+    p.h.magic = FLIGHTREC_MAGIC;
+    p.h.seq = next_seq++;
+    p.h.dropped = dropped;
+    flash.startWritePage(next_addr, (uint8_t *)&p);
+
+    p.h.len = 0;
+    ready[out] = false;
+    if(ready[fill]) fill ^= 1;
+
+    next_addr += PAGE_SIZE;
+    if(next_addr >= end_addr) next_addr = FLIGHTREC_START;
+    if((next_addr % SECTOR_SIZE) == 0 && !erase_pending) {
+        // this sector was erased ahead, now do the one after it. If its
+        // erase is still pending it is erased before the first write
+        erase_addr = next_sector(next_addr);
+        erase_pending = true;
+    }
+}
+#endif
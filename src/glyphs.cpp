@@ -0,0 +1,121 @@
+// Unicode to glyph mapping and the user glyphs loaded into RA8875 CGRAM
+//
+// Latin-1 maps straight onto the font ROM. Everything else that can be shown
+// is in glyph_map, sorted by codepoint and found by binary search, so the
+// lookup is at most 7 steps and the table stays in flash. Heavy, rounded and
+// dashed box drawing share the light glyphs.
+
+#include <Arduino.h>
+#include <RA8875.h>
+#include "glyphs.h"
+
+extern RA8875 tft;
+
+// 8x16 bitmaps, one byte per row with the leftmost pixel in bit 7
+static const uint8_t user_glyphs[GLYPH_USER_COUNT][16] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 80 U+2500 light horizontal
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 }, // 81 U+2502 light vertical
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 }, // 82 U+250C light down and right
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF0, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 }, // 83 U+2510 light down and left
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 84 U+2514 light up and right
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0xF0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 85 U+2518 light up and left
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 }, // 86 U+251C light vertical and right
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0xF0, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 }, // 87 U+2524 light vertical and left
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 }, // 88 U+252C light down and horizontal
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 89 U+2534 light up and horizontal
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0xFF, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 }, // 8A U+253C light vertical and horizontal
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 8B U+2550 double horizontal
+    { 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28 }, // 8C U+2551 double vertical
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3F, 0x20, 0x2F, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28 }, // 8D U+2554 double down and right
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF8, 0x08, 0xE8, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28 }, // 8E U+2557 double down and left
+    { 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x2F, 0x20, 0x3F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 8F U+255A double up and right
+    { 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0xE8, 0x08, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 90 U+255D double up and left
+    { 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x2F, 0x20, 0x2F, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28 }, // 91 U+2560 double vertical and right
+    { 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0xE8, 0x08, 0xE8, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28 }, // 92 U+2563 double vertical and left
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x00, 0xEF, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28 }, // 93 U+2566 double down and horizontal
+    { 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0xEF, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 94 U+2569 double up and horizontal
+    { 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0xEF, 0x00, 0xEF, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28 }, // 95 U+256C double vertical and horizontal
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }, // 96 U+2588 full block
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 97 U+2580 upper half block
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }, // 98 U+2584 lower half block
+    { 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0 }, // 99 U+258C left half block
+    { 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F }, // 9A U+2590 right half block
+    { 0x88, 0x22, 0x88, 0x22, 0x88, 0x22, 0x88, 0x22, 0x88, 0x22, 0x88, 0x22, 0x88, 0x22, 0x88, 0x22 }, // 9B U+2591 light shade
+    { 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55 }, // 9C U+2592 medium shade
+    { 0x77, 0xDD, 0x77, 0xDD, 0x77, 0xDD, 0x77, 0xDD, 0x77, 0xDD, 0x77, 0xDD, 0x77, 0xDD, 0x77, 0xDD }, // 9D U+2593 dark shade
+    { 0x00, 0x00, 0x10, 0x38, 0x44, 0xBA, 0xFA, 0xF6, 0xEE, 0xFE, 0x6C, 0x38, 0x10, 0x00, 0x00, 0x00 }, // 9E U+FFFD replacement character
+};
+
+#define G(n) (GLYPH_USER_FIRST + (n))
+
+struct glyph_map_t { uint16_t cp; uint8_t glyph; };
+
+static const glyph_map_t glyph_map[] = {
+    { 0x2013, '-' }, { 0x2014, '-' }, { 0x2015, '-' },                   // dashes
+    { 0x2018, '\'' }, { 0x2019, '\'' }, { 0x201A, '\'' },                // single quotes
+    { 0x201C, '"' }, { 0x201D, '"' }, { 0x201E, '"' },                    // double quotes
+    { 0x2022, 0xB7 },                                                   // bullet
+    { 0x2026, '.' },                                                    // ellipsis
+    { 0x2260, '#' }, { 0x2264, '<' }, { 0x2265, '>' },                  // not equal, less and greater or equal
+    { 0x23BA, G(0) }, { 0x23BB, G(0) }, { 0x23BC, G(0) }, { 0x23BD, G(0) }, // scan lines
+    { 0x2500, G(0) }, { 0x2501, G(0) }, { 0x2502, G(1) }, { 0x2503, G(1) },
+    { 0x2504, G(0) }, { 0x2505, G(0) }, { 0x2506, G(1) }, { 0x2507, G(1) },
+    { 0x2508, G(0) }, { 0x2509, G(0) }, { 0x250A, G(1) }, { 0x250B, G(1) },
+    { 0x250C, G(2) }, { 0x250F, G(2) }, { 0x2510, G(3) }, { 0x2513, G(3) },
+    { 0x2514, G(4) }, { 0x2517, G(4) }, { 0x2518, G(5) }, { 0x251B, G(5) },
+    { 0x251C, G(6) }, { 0x2523, G(6) }, { 0x2524, G(7) }, { 0x252B, G(7) },
+    { 0x252C, G(8) }, { 0x2533, G(8) }, { 0x2534, G(9) }, { 0x253B, G(9) },
+    { 0x253C, G(10) }, { 0x254B, G(10) },
+    { 0x254C, G(0) }, { 0x254D, G(0) }, { 0x254E, G(1) }, { 0x254F, G(1) },
+    { 0x2550, G(11) }, { 0x2551, G(12) }, { 0x2554, G(13) }, { 0x2557, G(14) },
+    { 0x255A, G(15) }, { 0x255D, G(16) }, { 0x2560, G(17) }, { 0x2563, G(18) },
+    { 0x2566, G(19) }, { 0x2569, G(20) }, { 0x256C, G(21) },
+    { 0x256D, G(2) }, { 0x256E, G(3) }, { 0x256F, G(5) }, { 0x2570, G(4) },  // rounded corners
+    { 0x2574, G(0) }, { 0x2575, G(1) }, { 0x2576, G(0) }, { 0x2577, G(1) },
+    { 0x2578, G(0) }, { 0x2579, G(1) }, { 0x257A, G(0) }, { 0x257B, G(1) },
+    { 0x2580, G(23) }, { 0x2584, G(24) }, { 0x2588, G(22) }, { 0x258C, G(25) },
+    { 0x2590, G(26) }, { 0x2591, G(27) }, { 0x2592, G(28) }, { 0x2593, G(29) },
+    { 0x25C6, 0xA4 },                                                   // diamond
+    { 0xFFFD, GLYPH_REPLACEMENT },
+};
+
+#define NGLYPHMAP (sizeof(glyph_map) / sizeof(glyph_map[0]))
+
+uint8_t glyph_for(uint32_t cp)
+{
+    if(cp >= 0xA0 && cp <= 0xFF) return cp;
+
+    // combining marks, zero width spaces and joiners, variation selectors, BOM
+    if((cp >= 0x0300 && cp <= 0x036F) || (cp >= 0x200B && cp <= 0x200F) ||
+       (cp >= 0xFE00 && cp <= 0xFE0F) || cp == 0xFEFF) return 0;
+
+    uint16_t lo = 0, hi = NGLYPHMAP;
+    while(lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if(glyph_map[mid].cp < cp) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo < NGLYPHMAP && glyph_map[lo].cp == cp) return glyph_map[lo].glyph;
+    return GLYPH_REPLACEMENT;
+}
+
+// DEC special graphics 0x5F-0x7E as unicode, as used by curses for line drawing
+static const uint16_t dec_graphics[32] = {
+    0x00A0, 0x25C6, 0x2592, 0x2409, 0x240C, 0x240D, 0x240A, 0x00B0,     // _`abcdef
+    0x00B1, 0x2424, 0x240B, 0x2518, 0x2510, 0x250C, 0x2514, 0x253C,     // ghijklmn
+    0x23BA, 0x23BB, 0x2500, 0x23BC, 0x23BD, 0x251C, 0x2524, 0x2534,     // opqrstuv
+    0x252C, 0x2502, 0x2264, 0x2265, 0x03C0, 0x2260, 0x00A3, 0x00B7,     // wxyz{|}~
+};
+
+uint8_t dec_graphics_glyph(char c)
+{
+    return glyph_for(dec_graphics[c - 0x5F]);
+}
+
+void glyphs_setup()
+{
+    tft.setIntFontCoding(ISO_IEC_8859_1);
+    for (uint8_t i = 0; i < GLYPH_USER_COUNT; i++) {
+        tft.uploadUserChar(user_glyphs[i], i);
+    }
+}
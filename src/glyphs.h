@@ -0,0 +1,30 @@
+//
+//  Glyphs for the characters the terminal can show, one byte per screen cell.
+//    0x20-0x7E  ASCII, from the RA8875 font ROM
+//    0x80-0x9E  box drawing, blocks and the replacement glyph, in RA8875 CGRAM
+//    0xA0-0xFF  Latin-1, from the RA8875 font ROM (ISO 8859-1 coding)
+
+#pragma once
+
+#include <stdint.h>
+
+#define GLYPH_USER_FIRST 0x80
+#define GLYPH_USER_COUNT 31
+#define GLYPH_REPLACEMENT (GLYPH_USER_FIRST + GLYPH_USER_COUNT - 1)
+#define GLYPH_HLINE (GLYPH_USER_FIRST + 0)          // light horizontal, a line across row 7 of 16
+#define GLYPH_VLINE (GLYPH_USER_FIRST + 1)          // light vertical
+#define GLYPH_DOUBLE_HLINE (GLYPH_USER_FIRST + 11)  // double horizontal, rows 6 and 8 of 16
+
+static inline bool is_user_glyph(char c)
+{
+    return (uint8_t)c >= GLYPH_USER_FIRST && (uint8_t)c < GLYPH_USER_FIRST + GLYPH_USER_COUNT;
+}
+
+// glyph for a unicode codepoint, 0 if it takes no cell (combining marks etc)
+uint8_t glyph_for(uint32_t cp);
+
+// glyph for c (0x5F-0x7E) in the DEC special graphics set
+uint8_t dec_graphics_glyph(char c);
+
+// select the Latin-1 font ROM and load the user glyphs into CGRAM
+void glyphs_setup();
@@ -2,6 +2,10 @@
 #include <SPI.h>
 #include <RA8875.h>
 #include "tinyflash.h"
+#include "crc32.h"
+#include "glyphs.h"
+#include "config.h"
+#include "RingBuffer.h"
 #include <EEPROM.h>
 
 // externs
@@ -15,8 +19,13 @@ uint16_t process_key(bool wait);
 //#define USETOUCH
 //#define KEYBOARD
 //#define DEBUG
+//#define FLIGHTREC
+//#define SPLIT
 
 #define FW_SOURCE_LEN 5478
+#define FW_RECORDS_PER_READ 32
+#define FW_PACKED_MAGIC "GSLP"
+#define FW_PACKED_VERSION 1
 
 #define RA8875_CS 10
 #define RA8875_RESET 255 //any pin, if you want to disable just set at 255 or not use at all
@@ -40,13 +49,29 @@ RA8875 tft = RA8875(RA8875_CS, RA8875_RESET, 11, 14, 12);
     #define FLASHFW to flash the firmware
     #define VERIFYFW to check it
     Make sure both are undefined to run program
+    In both modes the flash is driven over USB serial by flashfw.py
+
+    The firmware is either the packed image made by fwpack.py (checked
+    against its CRC before loading) or the older 8 byte per record image.
+    Anything else in the flash is not sent to the controller.
 */
-#ifdef USETOUCH
+#ifdef USEFLASH
 TinyFlash flash;
 uint32_t capacity = 0;
 #endif
 
+#if defined(FLASHFW) || defined(VERIFYFW)
+void flash_programmer(uint32_t capacity);
+#endif
+
+#ifdef FLIGHTREC
+void flightrec_setup(uint32_t capacity);
+void flightrec_byte(uint8_t c);
+void flightrec_poll();
+#endif
+
 bool has_touch = false;
+struct cal_point_t { uint16_t x, y; };
 uint16_t screen_width, screen_height;
 uint16_t char_width, char_height;
 
@@ -55,8 +80,112 @@ uint16_t char_width, char_height;
 void gsl_final_setup();
 void gsl_setup();
 void gsl_load_fw(uint8_t addr, uint8_t Wrbuf[4]);
+void gsl_load_fw_run(uint8_t reg, uint8_t *data, uint8_t len);
+bool gsl_poll();
+bool is_fw_loaded();
+
+extern const cal_point_t cal_targets[3];
+bool touch_cal_compute(const cal_point_t raw[3]);
+void touch_filter_reset();
+void touch_transform(uint16_t rx, uint16_t ry, int16_t& x, int16_t& y);
+#ifdef DEBUG
+void touch_benchmark();
+#endif
+bool touch_calibrate();
+
+// legacy image, FW_SOURCE_LEN records each of 8 bytes,
+// address byte, 3 padding bytes then 4 data bytes
+static bool load_legacy_fw()
+{
+    if(!flash.beginRead(0)) return false;
+
+    // read a flash page worth of records at a time
+    uint8_t records[FW_RECORDS_PER_READ * 8];
+    uint16_t source_len = FW_SOURCE_LEN;
+
+    for (uint32_t source_line = 0; source_line < source_len; source_line += FW_RECORDS_PER_READ) {
+        uint32_t n = source_len - source_line;
+        if(n > FW_RECORDS_PER_READ) n = FW_RECORDS_PER_READ;
+        flash.readNextBytes(records, n * 8);
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint8_t *rec = &records[i * 8];
+            gsl_load_fw(rec[0], &rec[4]);
+        }
+    }
+    flash.endRead();
+    return true;
+}
+
+// packed image as written by fwpack.py, a header followed by run records of
+// (start register, byte count, data...)
+struct fw_header_t {
+    char magic[4];
+    uint16_t version;
+    uint16_t runs;
+    uint32_t length;    // bytes of run records following the header
+    uint32_t crc;       // crc32 of the header before it and the run records
+};
+
+static bool load_packed_fw(const fw_header_t& hdr)
+{
+    uint8_t run[2 + 255];
+
+    // check the whole image before sending any of it to the controller, the
+    // runs must fill exactly hdr.length bytes and match the CRC
+    uint32_t crc = crc32_update(0, (const uint8_t *)&hdr, offsetof(fw_header_t, crc));
+    uint32_t n = 0;
+    bool fits = true;
+    if(!flash.beginRead(sizeof(hdr))) return false;
+    for (uint16_t i = 0; i < hdr.runs; i++) {
+        if(hdr.length - n < 2) {
+            fits = false;
+            break;
+        }
+        flash.readNextBytes(run, 2);
+        n += 2;
+        if(hdr.length - n < run[1]) {
+            fits = false;
+            break;
+        }
+        flash.readNextBytes(&run[2], run[1]);
+        n += run[1];
+        crc = crc32_update(crc, run, 2 + run[1]);
+    }
+    flash.endRead();
+
+    if(!fits || n != hdr.length) {
+#ifdef DEBUG
+        Serial.printf("Touch firmware runs do not fill %lu bytes\n", hdr.length);
+#endif
+        return false;
+    }
+
+    if(crc != hdr.crc) {
+#ifdef DEBUG
+        Serial.printf("Touch firmware CRC mismatch %08lX vs %08lX\n", crc, hdr.crc);
+#endif
+        return false;
+    }
+
+    if(!flash.beginRead(sizeof(hdr))) return false;
+    for (uint16_t i = 0; i < hdr.runs; i++) {
+        flash.readNextBytes(run, 2);
+        flash.readNextBytes(&run[2], run[1]);
+        gsl_load_fw_run(run[0], &run[2], run[1]);
+    }
+    flash.endRead();
+    return true;
+}
+
+// a legacy image has no header, it starts with a record whose address is
+// a little endian u32 below 0x100, so the 3 padding bytes are zero
+static bool is_legacy_fw(const fw_header_t& hdr)
+{
+    return hdr.magic[1] == 0 && hdr.magic[2] == 0 && hdr.magic[3] == 0;
+}
 
-void load_touch_fw()
+bool load_touch_fw()
 {
     gsl_setup();
 
@@ -65,36 +194,42 @@ void load_touch_fw()
 #endif
 
     tft.println("Loading Touch FIRMWARE...");
-    if(!flash.beginRead(0)) {
+
+    fw_header_t hdr;
+    bool ok = flash.read(0, (uint8_t *)&hdr, sizeof(hdr));
+    if(ok) {
+        if(memcmp(hdr.magic, FW_PACKED_MAGIC, sizeof(hdr.magic)) == 0) {
+            ok = hdr.version == FW_PACKED_VERSION && load_packed_fw(hdr);
+        } else {
+            ok = is_legacy_fw(hdr) && load_legacy_fw();
+        }
+    }
+
+    if(!ok) {
 #ifdef DEBUG
-        Serial.println("beginread failed");
+        Serial.println("firmware read failed");
 #endif
         tft.println("flash read failed");
         digitalWrite(LED, 0);
-        return;
+        return false;
     }
 
-    uint16_t source_len = FW_SOURCE_LEN;
-
-    for (uint32_t source_line = 0; source_line < source_len; source_line++) {
-        uint8_t addr = flash.readNextByte();
-        flash.readNextByte();
-        flash.readNextByte();
-        flash.readNextByte();
+    gsl_final_setup();
 
-        uint8_t buf[4];
-        buf[0] = flash.readNextByte();
-        buf[1] = flash.readNextByte();
-        buf[2] = flash.readNextByte();
-        buf[3] = flash.readNextByte();
-        gsl_load_fw(addr, buf);
+    // verify the controller is running the firmware we just sent it
+    if(!is_fw_loaded()) {
+#ifdef DEBUG
+        Serial.println("Touch Firmware verify failed");
+#endif
+        tft.println("Touch FIRMWARE verify failed");
+        return false;
     }
-    flash.endRead();
+
 #ifdef DEBUG
     Serial.println("Touch Firmware loaded ok");
 #endif
     tft.println("...Loaded Touch FIRMWARE");
-    gsl_final_setup();
+    return true;
 }
 #endif
 
@@ -106,122 +241,1254 @@ uint16_t text_color = RA8875_GREEN;
 bool local_echo = true;
 bool lfcrlf = true; // convert lf to crlf
 bool crcrlf = true; // convert cr to crlf
+uint8_t dim_delay = 0; // index into dim_minutes, 0 never dims
+uint8_t split = 0; // SPLIT builds, 0 one pane, 1 stacked, 2 side by side
+enum host_link_t { LINK_UART, LINK_USB, LINK_BOTH };
+uint8_t host_link = LINK_UART; // where the first session's host is connected
+
+// xterm mouse reporting, set by the host with DECSET 1000/1002 and 1006
+uint16_t mouse_mode = 0; // 0 off, 1000 press/release, 1002 also motion while pressed
+bool mouse_sgr = false;  // SGR encoding, otherwise X10 encoding
+
+// The text on the screen is kept in screen_cells, one byte per cell, and
+// only drawn by render(). Parsing just updates the cells and marks what
+// changed, so anything overwritten before the next frame is never drawn.
+// MAX_CELLS and MAX_ROWS are set in config.h.
+char screen_cells[MAX_CELLS];
+uint16_t grid_cols, grid_rows;
+// a cell of the main screen whose text was lost while the alternate screen
+// was up, see set_alt_screen(). Its pixels are still on layer 1 so it is
+// not blank, it becomes a blank once it has been filled over.
+#define LOST_CELL 0x7F
+
+// Each host port has a session, which owns a pane of the screen. The
+// session being parsed has its state in the globals below and its pane
+// in pane, switch_session() swaps them. screen_cols, screen_rows and the
+// cursor are the size of the pane and the position within it, cell_row()
+// and mark_dirty() add the pane's place in the grid.
+struct pane_t {
+    uint16_t col, row, cols, rows;
+    int16_t pending_scroll;     // rows scrolled up (or down if negative) since the last frame
+};
+static pane_t panes[SESSIONS];
+static pane_t *pane = &panes[0];
+// where the session's replies and keys go, the first session's host is on
+// Serial1 or USB, the second session is on Serial3 (pins 7 and 8) as
+// Serial2 transmits on the RA8875 chip select
+#ifdef SPLIT
+static Stream *ports[SESSIONS] = { &Serial1, &Serial3 };
+#else
+static Stream *ports[SESSIONS] = { &Serial1 };
+#endif
+Stream *port = &Serial1;
+uint8_t focus = 0; // the session the keyboard and touch go to
+void switch_session(uint8_t i);
+
+uint16_t screen_cols, screen_rows;
+uint16_t cursor_col = 0, cursor_row = 0;
+// A character written to the last column leaves the cursor there with a
+// wrap pending, the line only wraps when the next printable arrives.
+// Anything that moves the cursor cancels it. DECAWM (Esc[?7l) turns
+// wrapping off, then characters past the margin overwrite the last column.
+bool wrap_pending = false;
+bool autowrap = true;
+
+// changed columns of each row, lo > hi when the row is clean
+static uint8_t dirty_lo[MAX_ROWS], dirty_hi[MAX_ROWS];
+// the row was wrapped onto the next one, so reflow can join them again
+static bool row_wrapped[MAX_ROWS];
+// the whole screen was cleared since the last frame
+static bool pending_clear = false;
+static uint16_t drawn_col = 0xFFFF, drawn_row = 0xFFFF;
+
+// host output is kept here until it is parsed, a buffer for each session
+// so a flood on one port cannot hold up the other
+RingBuffer<char, RX_BUFFER_SIZE> rx_buffers[SESSIONS];
+
+#define FRAME_MS 20             // at most 50 frames a second
+#define FRAME_MAX_MS 100        // draw even if the host never stops sending
+#define RENDER_SLICE_MS 4       // longest a render() call draws before it returns
+#define PARSE_SLICE 256         // bytes parsed between UART drains
+
+// row of the whole screen
+static inline char *grid_row(uint16_t row)
+{
+    return &screen_cells[row * grid_cols];
+}
 
-void clear_screen()
+// row of the current pane
+static inline char *cell_row(uint16_t row)
 {
-    tft.fillWindow(RA8875_BLACK);
-    tft.setCursor(0, 0);
+    return &grid_row(pane->row + row)[pane->col];
 }
 
-void save_settings()
+static void mark_clean()
 {
-    EEPROM.write(0, 0xA5);
-    uint8_t br;
-    switch(baudrate) {
-        case 1200:   br= 0; break;
-        case 2400:   br= 1; break;
-        case 4800:   br= 2; break;
-        case 9600:   br= 3; break;
-        case 19200:  br= 4; break;
-        case 115200: br= 5; break;
-        default:     br= 3; break;
-    }
-    EEPROM.write(1, br);
-    EEPROM.write(2, rotation);
-    EEPROM.write(3, font_size);
-    EEPROM.write(4, text_color & 0xFF);
-    EEPROM.write(5, text_color >> 8);
-    EEPROM.write(6, local_echo);
-    EEPROM.write(7, lfcrlf);
-    EEPROM.write(8, crcrlf);
+    memset(dirty_lo, 0xFF, sizeof(dirty_lo));
+    memset(dirty_hi, 0, sizeof(dirty_hi));
 }
 
-void get_settings()
+// columns c0 to c1 inclusive of a row of the whole screen need drawing
+static void mark_grid_dirty(uint16_t row, uint16_t c0, uint16_t c1)
+{
+    if(c0 < dirty_lo[row]) dirty_lo[row] = c0;
+    if(c1 > dirty_hi[row]) dirty_hi[row] = c1;
+}
+
+// columns c0 to c1 inclusive of row of the current pane need drawing
+void mark_dirty(uint16_t row, uint16_t c0, uint16_t c1)
+{
+    mark_grid_dirty(pane->row + row, pane->col + c0, pane->col + c1);
+}
+
+// redraw rows r0 to r1 inclusive of the whole screen from the retained text
+void redraw_rows(uint16_t r0, uint16_t r1)
+{
+    for (uint16_t r = r0; r <= r1 && r < grid_rows; r++) {
+        mark_grid_dirty(r, 0, grid_cols - 1);
+    }
+}
+
+// redraw the whole screen from the cells, for when the pixels no longer match them
+static void repaint_all()
 {
-    // read config settings stored in eeprom
-    // first time settings are set will write the defaults and any changes
-    uint8_t value = EEPROM.read(0);
-    if(value == 0xA5) {
-        // configs have been stored
-        value = EEPROM.read(1);
-        switch(value) {
-            case 0: baudrate = 1200; break;
-            case 1: baudrate = 2400; break;
-            case 2: baudrate = 4800; break;
-            case 3: baudrate = 9600; break;
-            case 4: baudrate = 19200; break;
-            case 5: baudrate = 115200; break;
-            default: baudrate = 9600; break;
-        }
-        rotation = EEPROM.read(2);
-        font_size = EEPROM.read(3);
-        text_color = (EEPROM.read(5) << 8) | EEPROM.read(4);
-        local_echo = EEPROM.read(6) != 0;
-        lfcrlf = EEPROM.read(7) != 0;
-        crcrlf = EEPROM.read(8) != 0;
+    mark_clean();
+    for (uint8_t i = 0; i < SESSIONS; i++) panes[i].pending_scroll = 0;
+    pending_clear = true;
+    for (uint16_t r = 0; r < grid_rows; r++) {
+        char *p = grid_row(r);
+        for (uint16_t c = 0; c < grid_cols; c++) {
+            if(p[c] == LOST_CELL) p[c] = ' ';
+        }
+        uint16_t c0 = 0, c1 = grid_cols;
+        while(c0 < c1 && p[c0] == ' ') ++c0;
+        while(c1 > c0 && p[c1 - 1] == ' ') --c1;
+        if(c0 < c1) mark_grid_dirty(r, c0, c1 - 1);
     }
+}
+
+// pick up the screen and font dimensions after a rotation or font change
+static void read_geometry()
+{
+    screen_width = tft.width();
+    screen_height = tft.height();
+    char_width = tft.getFontWidth();
+    char_height = tft.getFontHeight();
+    // the dirty spans hold columns in a byte
+    grid_cols = min(screen_width / char_width, 255);
+    grid_rows = min(screen_height / char_height, MAX_ROWS);
+    if(grid_cols * grid_rows > MAX_CELLS) grid_rows = MAX_CELLS / grid_cols;
+
+    // split the screen into a pane per session, with a line between them
+    for (uint8_t i = 0; i < SESSIONS; i++) {
+        panes[i] = { 0, 0, grid_cols, grid_rows, 0 };
+    }
+#ifdef SPLIT
+    if(split == 1) {
+        panes[0].rows = (grid_rows - 1) / 2;
+        panes[1].row = panes[0].rows + 1;
+        panes[1].rows = grid_rows - panes[1].row;
+    } else if(split == 2) {
+        panes[0].cols = (grid_cols - 1) / 2;
+        panes[1].col = panes[0].cols + 1;
+        panes[1].cols = grid_cols - panes[1].col;
+    }
+#endif
+    screen_cols = pane->cols;
+    screen_rows = pane->rows;
+}
+
+// start with a blank screen of the current dimensions
+void set_geometry()
+{
+    read_geometry();
+    memset(screen_cells, ' ', sizeof(screen_cells));
+    memset(row_wrapped, 0, sizeof(row_wrapped));
+    mark_clean();
+#ifdef SPLIT
+    if(split == 1) {
+        memset(grid_row(panes[0].rows), GLYPH_HLINE, grid_cols);
+    } else if(split == 2) {
+        for (uint16_t r = 0; r < grid_rows; r++) grid_row(r)[panes[0].cols] = GLYPH_VLINE;
+    }
+#endif
+    // every session starts at the top left of its pane, ending with the first
+    for (uint8_t i = SESSIONS; i-- > 0; ) {
+        switch_session(i);
+        cursor_col = cursor_row = 0;
+        wrap_pending = false;
+    }
+}
+
+// When there is nothing to parse or draw loop() sleeps in idle_wait()
+// until the next interrupt. The UART, USB and touch interrupts wake it,
+// and the 1ms SysTick bounds the sleep for everything that is polled, the
+// keyboard DCD line (pin 17 cannot interrupt on the LC), the frame timer
+// and the flight recorder. The UART interrupt has already put the byte in
+// the core's 64 byte Serial1 buffer, so a slow wake costs latency but
+// only loses bytes if the buffer fills, 5.5ms at 115200 baud. DEBUG
+// builds report the slowest wake to drain time to check that margin.
+const uint16_t dim_minutes[] = { 0, 1, 5, 15, 60 };
+#define NDIMDELAYS (sizeof(dim_minutes) / sizeof(dim_minutes[0]))
+#define BRIGHTNESS_FULL 255
+#define BRIGHTNESS_DIM 16
+static uint32_t last_activity = 0;
+static bool dimmed = false;
 #ifdef DEBUG
-    else {
-        Serial.println("No settings found in EEPROM");
+static uint32_t wake_at = 0, worst_wake = 0, slept_us = 0;
+#endif
+
+// host output, a key or a touch, undims the backlight
+void activity()
+{
+    last_activity = millis();
+    if(dimmed) {
+        tft.brightness(BRIGHTNESS_FULL);
+        dimmed = false;
     }
+}
+
+// the first session's host is read over USB, DEBUG builds always take
+// input from USB as well
+static bool reads_usb()
+{
+#ifdef DEBUG
+    return true;
+#else
+    return host_link != LINK_UART;
 #endif
 }
 
-// command line based setup for now
-void config_setup()
+// sleep until the next interrupt, except in the host tests built for the PC
+static inline void wait_for_interrupt()
 {
-    clear_screen();
+#ifdef __arm__
+    asm volatile("wfi");
+#endif
+}
 
-    bool done= false;
-    while(!done) {
-        tft.println("Enter the values to change,\r\nspace skips to next,\r\nq quits");
-        char k;
+static void idle_wait()
+{
+    if(dim_delay != 0 && !dimmed && millis() - last_activity >= dim_minutes[dim_delay] * 60000UL) {
+        tft.brightness(BRIGHTNESS_DIM);
+        dimmed = true;
+    }
 
-        tft.print("font size (0,1,2,3) > ");
-        k= process_key(true) & 0xFF; if(k == 'q') break;
-        if(k >= '0' && k <= '3') {
-            font_size= k - '0';
-            tft.setFontScale(font_size);
-            char_width = tft.getFontWidth();
-            char_height = tft.getFontHeight();
-            clear_screen();
+#ifdef DEBUG
+    uint32_t start = micros();
+#endif
+    // an interrupt after the check still ends the WFI, it is only taken
+    // once interrupts are enabled again
+    __disable_irq();
+    // only the ports buffer_input() reads, bytes on any other would never
+    // be taken and would keep it awake
+    bool waiting = (reads_usb() && Serial.available()) || (host_link != LINK_USB && Serial1.available());
+#ifdef SPLIT
+    waiting = waiting || (split && Serial3.available());
+#endif
+    if(!waiting) wait_for_interrupt();
+    __enable_irq();
+#ifdef DEBUG
+    wake_at = micros();
+    slept_us += wake_at - start;
+#endif
+}
+
+// send the first session's replies and keys to s
+static void use_link(Stream *s)
+{
+    if(port == ports[0]) port = s;
+    ports[0] = s;
+}
+
+// USB is read a chunk at a time straight into rx, rather than a byte at a
+// time. Nothing is lost when rx is full, the host just waits, so there is
+// no need to tell the caller. Returns true if anything was read
+static bool drain_usb(RingBuffer<char, RX_BUFFER_SIZE>& rx)
+{
+    bool got = false;
+    int avail;
+    while((avail = Serial.available()) > 0) {
+        size_t n;
+        char *p = rx.back_span(n);
+        if(n == 0) break;
+        n = Serial.readBytes(p, min(n, (size_t)avail));
+        if(n == 0) break;
+#ifdef FLIGHTREC
+        for (size_t i = 0; i < n; i++) flightrec_byte(p[i]);
+#endif
+        rx.commit(n);
+        got = true;
+    }
+    return got;
+}
+
+// move what a port has received into rx, false if rx fills up first
+static bool drain(Stream& s, RingBuffer<char, RX_BUFFER_SIZE>& rx, bool record)
+{
+    while(s.available()) {
+        if(rx.full()) return false;
+        char c = s.read();
+#ifdef FLIGHTREC
+        if(record) flightrec_byte(c);
+#endif
+        rx.push_back(c);
+    }
+    return true;
+}
+
+static size_t buffered()
+{
+    size_t n = 0;
+    for (uint8_t i = 0; i < SESSIONS; i++) n += rx_buffers[i].get_size();
+    return n;
+}
+
+// read what the hosts have sent into rx_buffers, returns false once one is full
+bool buffer_input()
+{
+    size_t before = buffered();
+    bool ok = true;
+    if(reads_usb() && drain_usb(rx_buffers[0]) && host_link == LINK_BOTH) use_link(&Serial);
+
+    if(host_link != LINK_USB) {
+        size_t n = rx_buffers[0].get_size();
+        ok = drain(Serial1, rx_buffers[0], true);
+        // with both links replies go to whichever sent last
+        if(rx_buffers[0].get_size() != n && host_link == LINK_BOTH) use_link(&Serial1);
+    }
+#ifdef SPLIT
+    // the other session has its own buffer, so it is read even when the first is full
+    if(split) ok = drain(Serial3, rx_buffers[1], false) && ok;
+#endif
+
+    if(buffered() != before) {
+        activity();
+#ifdef DEBUG
+        // time from waking to having drained the UART
+        if(wake_at != 0 && micros() - wake_at > worst_wake) worst_wake = micros() - wake_at;
+#endif
+    }
+#ifdef DEBUG
+    wake_at = 0;
+#endif
+    return ok;
+}
+
+// open the host ports at the current baud rate
+static void begin_ports()
+{
+    Serial1.begin(baudrate, SERIAL_8N1);
+#ifdef SPLIT
+    if(split) Serial3.begin(baudrate, SERIAL_8N1);
+    else Serial3.end();
+#endif
+}
+
+// The RA8875 does a BTE move by itself once it has been set up, so a
+// scroll is started and then left to run while parsing carries on. Any
+// other drawing first waits for it with draw_fence().
+#define RA8875_STATUS_BTE_BUSY 0x40
+#define BTE_TIMEOUT_MS 50       // the old fixed wait, in case the status is never cleared
+static bool bte_running = false;
+static uint32_t bte_start;
+
+// true while the RA8875 is still moving pixels
+static bool bte_busy()
+{
+    if(!bte_running) return false;
+    if((tft.readStatus() & RA8875_STATUS_BTE_BUSY) && millis() - bte_start < BTE_TIMEOUT_MS) return true;
+    bte_running = false;
+    return false;
+}
+
+// wait until the RA8875 has finished, while still taking in host output
+void draw_fence()
+{
+    while(bte_busy()) buffer_input();
+}
+
+// blank columns c0 to c1 inclusive of row
+void erase_cells(uint16_t row, uint16_t c0, uint16_t c1)
+{
+    if(row >= screen_rows || c0 > c1) return;
+    if(c1 >= screen_cols) c1 = screen_cols - 1;
+    if(c1 == screen_cols - 1) row_wrapped[pane->row + row] = false;
+
+    // cells that are already blank need nothing drawn
+    char *p = cell_row(row);
+    while(c0 <= c1 && p[c0] == ' ') ++c0;
+    while(c1 >= c0 && p[c1] == ' ') --c1;
+    if(c0 > c1) return;
+
+    memset(&p[c0], ' ', c1 - c0 + 1);
+    mark_dirty(row, c0, c1);
+}
+
+// blank rows r0 to r1 inclusive
+void erase_rows(uint16_t r0, uint16_t r1)
+{
+    for (uint16_t r = r0; r <= r1 && r < screen_rows; r++) {
+        erase_cells(r, 0, screen_cols - 1);
+    }
+}
+
+// move the pixels to catch up with the scrolled cells, a pane at a time
+// as the RA8875 does one move at once
+static void render_scroll()
+{
+    for (uint8_t i = 0; i < SESSIONS; i++) {
+        pane_t& p = panes[i];
+        int16_t n = p.pending_scroll;
+        if(n == 0) continue;
+        if(bte_busy()) return;
+        p.pending_scroll = 0;
+
+        // a pane at the right edge also moves the pixels past its last column
+        int16_t x = p.col * char_width, y = p.row * char_height;
+        int16_t w = p.col + p.cols == grid_cols ? screen_width - x : p.cols * char_width;
+        int16_t h = (p.rows - abs(n)) * char_height;
+        if(n > 0) {
+            tft.BTE_move(x, y + n * char_height, w, h, x, y);
+        } else {
+            int16_t bottom = y + p.rows * char_height - 1;
+            tft.BTE_move(x + w - 1, y + h - 1, w, h, x + w - 1, bottom, 0, 0, false, RA8875_BTEROP_SOURCE, false, true);
         }
-        tft.println();
-
-        tft.print("rotation (0,1) > ");
-        k= process_key(true) & 0xFF; if(k == 'q') break;
-        if(k >= '0' && k <= '1') {
-            rotation= k - '0';
-            tft.setRotation(rotation);
-            screen_width = tft.width();
-            screen_height = tft.height();
-            char_width = tft.getFontWidth();
-            char_height = tft.getFontHeight();
-            clear_screen();
+        bte_running = true;
+        bte_start = millis();
+    }
+}
+
+// scroll the cells of the pane n rows up (n > 0) or down (n < 0), the uncovered rows are blank
+void scroll_cells(int16_t n)
+{
+    if(n == 0) return;
+    if(abs(n) > screen_rows) n = n > 0 ? screen_rows : -screen_rows;
+
+    // a change of direction cannot be done with one move, redraw instead
+    // rather than wait here for the first move to be drawn
+    if((n > 0 && pane->pending_scroll < 0) || (n < 0 && pane->pending_scroll > 0)) repaint_all();
+    // nothing to move if the screen is to be cleared anyway
+    if(!pending_clear) pane->pending_scroll += n;
+
+    uint16_t keep = screen_rows - abs(n);
+    uint8_t *lo = &dirty_lo[pane->row], *hi = &dirty_hi[pane->row];
+    bool *wrapped = &row_wrapped[pane->row];
+    if(screen_cols < grid_cols) {
+        // the rows are shared with the pane alongside, which keeps its
+        // dirty spans, so the moved spans are added to the rows they move to
+        uint16_t c0 = pane->col, c1 = pane->col + screen_cols - 1;
+        for (uint16_t k = 0; k < keep; k++) {
+            uint16_t to = n > 0 ? k : screen_rows - 1 - k;
+            uint16_t from = n > 0 ? k + n : to + n;
+            memmove(cell_row(to), cell_row(from), screen_cols);
+            if(lo[from] <= c1 && hi[from] >= c0) mark_grid_dirty(pane->row + to, max(lo[from], (uint8_t)c0), min(hi[from], (uint8_t)c1));
         }
-        tft.println();
+        if(n > 0) erase_rows(keep, screen_rows - 1);
+        else erase_rows(0, -n - 1);
+    } else if(n > 0) {
+        memmove(cell_row(0), cell_row(n), keep * screen_cols);
+        memmove(lo, &lo[n], keep);
+        memmove(hi, &hi[n], keep);
+        memmove(wrapped, &wrapped[n], keep);
+        memset(&lo[keep], 0xFF, n);
+        memset(&hi[keep], 0, n);
+        erase_rows(keep, screen_rows - 1);
+    } else {
+        n = -n;
+        memmove(cell_row(n), cell_row(0), keep * screen_cols);
+        memmove(&lo[n], lo, keep);
+        memmove(&hi[n], hi, keep);
+        memmove(&wrapped[n], wrapped, keep);
+        memset(lo, 0xFF, n);
+        memset(hi, 0, n);
+        erase_rows(0, n - 1);
+    }
+
+    // scrolled a whole pane or more since the last frame, so none of the
+    // pixels can be moved into place
+    if(abs(pane->pending_scroll) >= screen_rows) repaint_all();
+}
 
-        tft.print("local Echo (0,1) > ");
-        k= process_key(true) & 0xFF; if(k == 'q') break;
-        if(k >= '0' && k <= '1') {
-            local_echo= (k == '1');
+void scroll_up()
+{
+    scroll_cells(1);
+}
+
+void scroll_down()
+{
+    scroll_cells(-1);
+}
+
+void clear_screen()
+{
+#ifdef SPLIT
+    if(split) {
+        // just this pane, the other one and the line between them stay
+        erase_rows(0, screen_rows - 1);
+        cursor_col = cursor_row = 0;
+        wrap_pending = false;
+        return;
+    }
+#endif
+    memset(screen_cells, ' ', sizeof(screen_cells));
+    memset(row_wrapped, 0, sizeof(row_wrapped));
+    mark_clean();
+    pane->pending_scroll = 0;
+    pending_clear = true;
+    cursor_col = cursor_row = 0;
+    wrap_pending = false;
+}
+
+// The area of a dirty row to fill, widened over the blank cells either
+// side as those are black already. Rows of a progress bar or a screen of
+// erased lines then end up with the same span and share one fill.
+static void fill_span(uint16_t row, uint16_t& c0, uint16_t& c1)
+{
+    const char *p = grid_row(row);
+    c0 = dirty_lo[row];
+    c1 = dirty_hi[row];
+    while(c0 > 0 && p[c0 - 1] == ' ') --c0;
+    while(c1 < grid_cols - 1 && p[c1 + 1] == ' ') ++c1;
+}
+
+// print n cells starting at col, row. Font ROM characters are printed a run
+// at a time and the glyphs held in CGRAM one by one, except that a run of
+// horizontal lines is drawn as one rectangle per line
+static void draw_text(uint16_t col, uint16_t row, const char *p, uint16_t n)
+{
+    while(n > 0) {
+        uint16_t k = 0;
+        while(k < n && !is_user_glyph(p[k])) ++k;
+
+        int16_t x = col * char_width, y = row * char_height;
+        uint8_t g = p[0];
+        if(k == 0 && (g == GLYPH_HLINE || g == GLYPH_DOUBLE_HLINE)) {
+            while(k < n && (uint8_t)p[k] == g) ++k;
+            // the glyph rows scaled to the font size, lines are one glyph pixel thick
+            int16_t t = char_height / 16, w = k * char_width;
+            if(g == GLYPH_HLINE) {
+                tft.fillRect(x, y + 7 * t, w, t, text_color);
+            } else {
+                tft.fillRect(x, y + 6 * t, w, t, text_color);
+                tft.fillRect(x, y + 8 * t, w, t, text_color);
+            }
+        } else if(k == 0) {
+            tft.setCursor(x, y);
+            tft.showUserChar(g - GLYPH_USER_FIRST);
+            k = 1;
+        } else {
+            tft.setCursor(x, y);
+            char line[k + 1];
+            memcpy(line, p, k);
+            line[k] = '\0';
+            tft.print(line);
+        }
+        col += k;
+        p += k;
+        n -= k;
+    }
+}
+
+// fill columns c0 to c1 of rows r0 to r1 with one fillRect, then draw the text
+static void render_rows(uint16_t r0, uint16_t r1, uint16_t c0, uint16_t c1)
+{
+    tft.fillRect(c0 * char_width, r0 * char_height, (c1 - c0 + 1) * char_width, (r1 - r0 + 1) * char_height, RA8875_BLACK);
+
+    for (uint16_t r = r0; r <= r1; r++) {
+        dirty_lo[r] = 0xFF;
+        dirty_hi[r] = 0;
+
+        // blanks only need the fill, and lost text is gone now
+        char *p = grid_row(r);
+        for (uint16_t c = c0; c <= c1; c++) {
+            if(p[c] == LOST_CELL) p[c] = ' ';
+        }
+        uint16_t a = c0, b = c1 + 1;
+        while(a < b && p[a] == ' ') ++a;
+        while(b > a && p[b - 1] == ' ') --b;
+        if(a == b) continue;
+
+        draw_text(a, r, &p[a], b - a);
+    }
+    drawn_row = 0xFFFF;
+}
+
+// Draw what has changed since the last frame. Gives up after RENDER_SLICE_MS,
+// or while a scroll is still being done by the RA8875, so the UART keeps
+// being drained. Returns true once everything is drawn.
+bool render()
+{
+    uint32_t start = millis();
+
+    if(bte_busy()) return false;
+    if(pending_clear) {
+        tft.fillWindow(RA8875_BLACK);
+        pending_clear = false;
+        drawn_row = 0xFFFF;
+    }
+    render_scroll();
+    if(bte_busy()) return false;
+
+    for (uint16_t r = 0; r < grid_rows; ) {
+        if(dirty_lo[r] > dirty_hi[r]) {
+            r++;
+            continue;
         }
-        tft.println();
 
-        tft.print("Save (y/n/r) > ");
-        k= process_key(true) & 0xFF; if(k == 'q') break;
-        if(k == 'r') {
-            EEPROM.write(0, 0);
-            tft.println("\r\nSettings restored");
-        } else if(k == 'y') {
+        // merge the following dirty rows that fill the same columns
+        uint16_t c0, c1, n0, n1;
+        fill_span(r, c0, c1);
+        uint16_t r1 = r;
+        while(r1 + 1 < grid_rows && dirty_lo[r1 + 1] <= dirty_hi[r1 + 1]) {
+            fill_span(r1 + 1, n0, n1);
+            if(n0 != c0 || n1 != c1) break;
+            ++r1;
+        }
+
+        render_rows(r, r1, c0, c1);
+        r = r1 + 1;
+        buffer_input();
+        if(millis() - start >= RENDER_SLICE_MS) return false;
+    }
+
+    // put the hardware cursor where the terminal cursor is, loop() has
+    // the session with the keyboard focus current when it draws
+    uint16_t col = pane->col + cursor_col, row = pane->row + cursor_row;
+    if(drawn_col != col || drawn_row != row) {
+        tft.setCursor(col * char_width, row * char_height);
+        drawn_col = col;
+        drawn_row = row;
+    }
+    return true;
+}
+
+// draw everything now, needed before drawing directly on the screen
+void render_flush()
+{
+    while(!render()) buffer_input();
+}
+
+// Esc7/Esc8 and Esc[s/Esc[u save and restore the cursor
+struct saved_cursor_t { uint16_t col, row; };
+saved_cursor_t saved_cursor = { 0, 0 };
+
+void save_cursor(saved_cursor_t& c)
+{
+    c.col = cursor_col;
+    c.row = cursor_row;
+}
+
+void restore_cursor(const saved_cursor_t& c)
+{
+    cursor_col = min(c.col, (uint16_t)(screen_cols - 1));
+    cursor_row = min(c.row, (uint16_t)(screen_rows - 1));
+    wrap_pending = false;
+}
+
+// Alternate screen, DECSET 1049 (and 47/1047). The main screen stays on
+// RA8875 layer 1 while the alternate screen is drawn on layer 2, so going
+// back is just a layer switch. The retained text of the main screen is
+// packed into main_cells as rows of (length, text without trailing blanks).
+// A full screen of text does not fit, there is not the RAM for a second
+// screen_cells. The rows that do not fit keep their pixels on layer 1 and
+// come back as LOST_CELL, so they are left as they are until something is
+// drawn over them, they are only blank after a repaint.
+bool alt_screen = false;
+static char main_cells[MAIN_CELLS_SIZE];
+static uint16_t main_rows = 0;
+static saved_cursor_t main_cursor;
+
+void set_alt_screen(bool on, bool cursor)
+{
+#ifdef SPLIT
+    // a pane has no screen to switch to, so it is just cleared, and the
+    // cursor saved as with Esc7
+    if(split) {
+        if(on && cursor) save_cursor(saved_cursor);
+        clear_screen();
+        if(!on && cursor) restore_cursor(saved_cursor);
+        return;
+    }
+#endif
+    if(on == alt_screen) return;
+    alt_screen = on;
+
+    // Anything not yet drawn on the main screen is left until it is shown
+    // again rather than drawn now, so an application switching screens
+    // over and over costs no drawing, as long as its text all fits in
+    // main_cells
+    static bool main_stale;
+    if(on) {
+        main_stale = pending_clear || pane->pending_scroll != 0;
+        for (uint16_t r = 0; r < screen_rows && !main_stale; r++) {
+            main_stale = dirty_lo[r] <= dirty_hi[r];
+        }
+    }
+    draw_fence();
+    drawn_row = 0xFFFF;
+
+    if(on) {
+        if(cursor) save_cursor(main_cursor);
+
+        // pack the main screen text
+        uint16_t n = 0;
+        for (main_rows = 0; main_rows < screen_rows; main_rows++) {
+            const char *p = cell_row(main_rows);
+            uint16_t len = screen_cols;
+            while(len > 0 && p[len - 1] == ' ') --len;
+            if(n + 1 + len > MAIN_CELLS_SIZE) break;
+            main_cells[n++] = len;
+            memcpy(&main_cells[n], p, len);
+            n += len;
+        }
+
+        // layer 1 can only be repainted from a complete copy, without one
+        // what is left to draw is drawn before leaving it
+        if(main_stale && main_rows < screen_rows) {
+            render_flush();
+            main_stale = false;
+        }
+
+        tft.writeTo(L2);
+        tft.layerEffect(LAYER2);
+        clear_screen();
+
+    } else {
+        tft.writeTo(L1);
+        tft.layerEffect(LAYER1);
+
+        memset(screen_cells, ' ', sizeof(screen_cells));
+        uint16_t n = 0;
+        for (uint16_t r = 0; r < main_rows; r++) {
+            uint8_t len = main_cells[n++];
+            memcpy(cell_row(r), &main_cells[n], len);
+            n += len;
+        }
+        memset(cell_row(main_rows), LOST_CELL, (screen_rows - main_rows) * screen_cols);
+        memset(row_wrapped, 0, sizeof(row_wrapped));
+        if(cursor) restore_cursor(main_cursor);
+
+        // what was left to draw on the alternate screen no longer matters
+        if(main_stale) {
+            repaint_all();
+        } else {
+            mark_clean();
+            pane->pending_scroll = 0;
+            pending_clear = false;
+        }
+    }
+}
+
+// tell the host the screen size in characters, as xterm does for Esc[18t
+void send_size_report()
+{
+    char report[16];
+    int n = snprintf(report, sizeof(report), "\x1B[8;%u;%ut", screen_rows, screen_cols);
+    // a host asking over and over must not stall the terminal on a full transmit buffer
+    if(port->availableForWrite() >= n) port->write((const uint8_t *)report, n);
+}
+
+// Fit the retained text to the new screen size after a rotation or font
+// change, rows that were wrapped are joined again and wrapped at the new
+// width. The lines nearest the cursor are kept if it all no longer fits.
+// This is done within screen_cells: the text is first packed into lines
+// without their trailing blanks, moved to the end of the buffer and then
+// laid out again from the start, dropping the top row whenever the new
+// rows would run into text not yet read.
+void reflow_screen()
+{
+    uint16_t old_cols = screen_cols, old_rows = screen_rows;
+
+    uint16_t line_end[MAX_ROWS];
+    uint16_t nlines = 0, len = 0, cursor_off = 0, cursor_line = 0;
+    for (uint16_t r = 0; r < old_rows; r++) {
+        const char *p = &screen_cells[r * old_cols];
+        uint16_t n = old_cols;
+        if(!row_wrapped[r]) {
+            while(n > 0 && p[n - 1] == ' ') --n;
+            // the cell under the cursor stays part of the line
+            if(r == cursor_row && n <= cursor_col) n = cursor_col + 1;
+        }
+        if(r == cursor_row) {
+            cursor_off = len + cursor_col;
+            cursor_line = nlines;
+        }
+        memmove(&screen_cells[len], p, n);
+        len += n;
+        if(!row_wrapped[r] || r == old_rows - 1) line_end[nlines++] = len;
+    }
+
+    // blank lines below the cursor are not kept
+    while(nlines > cursor_line + 1 && line_end[nlines - 1] == line_end[nlines - 2]) --nlines;
+    len = line_end[nlines - 1];
+
+    read_geometry();
+    uint16_t cols = screen_cols;
+
+    // leave room for at least one row in front of the text, text this far
+    // up would not fit on the screen anyway
+    uint16_t skip = len > MAX_CELLS - cols ? len - (MAX_CELLS - cols) : 0;
+    uint16_t base = MAX_CELLS - (len - skip);
+    memmove(&screen_cells[base], &screen_cells[skip], len - skip);
+
+    memset(row_wrapped, 0, sizeof(row_wrapped));
+    uint16_t rows = 0, new_col = 0, new_row = 0xFFFF;
+    uint16_t start = skip;
+    for (uint16_t i = 0; i < nlines; i++) {
+        uint16_t end = line_end[i];
+        if(end <= skip && skip > 0) {
+            start = end;
+            continue;
+        }
+        if(start < skip) start = skip;
+
+        uint16_t n = end - start;
+        do {
+            uint16_t k = min(n, cols);
+            uint16_t from = base + start - skip;
+
+            // drop the top row if this one would overwrite unread text
+            while(rows > 0 && (rows == screen_rows || (rows + 1) * cols > from + k)) {
+                memmove(screen_cells, &screen_cells[cols], (rows - 1) * cols);
+                memmove(row_wrapped, &row_wrapped[1], rows - 1);
+                --rows;
+                if(new_row != 0xFFFF && new_row > 0) --new_row;
+            }
+
+            char *dst = &screen_cells[rows * cols];
+            memmove(dst, &screen_cells[from], k);
+            memset(dst + k, ' ', cols - k);
+
+            if(i == cursor_line && cursor_off >= start && (cursor_off < start + k || k == 0)) {
+                new_row = rows;
+                new_col = cursor_off - start;
+            }
+            start += k;
+            n -= k;
+            row_wrapped[rows++] = n > 0;
+        } while(n > 0);
+    }
+    memset(&screen_cells[rows * cols], ' ', MAX_CELLS - rows * cols);
+
+    if(new_row == 0xFFFF) {
+        new_row = min(rows, (uint16_t)(screen_rows - 1));
+        new_col = 0;
+        wrap_pending = false;
+    } else if(wrap_pending && new_col < cols - 1) {
+        // the wrap is only still pending if the cursor is at the margin
+        ++new_col;
+        wrap_pending = false;
+    }
+    cursor_row = new_row;
+    cursor_col = new_col;
+
+    repaint_all();
+    send_size_report();
+}
+
+// Settings are stored as a versioned, CRC checked block in one of
+// SETTINGS_SLOTS slots. Each save goes to the next slot to spread the wear,
+// and only bytes that differ are written. The newest valid slot is used.
+// Fields may only be added to the end of settings_t, an older shorter block
+// still loads and the new fields keep their defaults.
+#define SETTINGS_MAGIC 0xC5
+#define SETTINGS_VERSION 1
+#define SETTINGS_SLOT_SIZE 32
+#define SETTINGS_SLOTS 4
+#define SETTINGS_LEGACY_MAGIC 0xA5 // the original fixed 9 byte layout
+
+// flags
+#define SET_LOCAL_ECHO 0x01
+#define SET_LFCRLF     0x02
+#define SET_CRCRLF     0x04
+#define SET_TOUCH_CAL  0x08
+
+struct settings_t {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t length;         // bytes in the slot including the trailing crc32
+    uint8_t seq;            // incremented on each save, the newest slot wins
+    uint8_t baud;           // index into baudrates
+    uint8_t rotation;
+    uint8_t font_size;
+    uint8_t flags;
+    uint16_t text_color;
+    cal_point_t touch_cal[3];
+    uint8_t dim_delay;      // index into dim_minutes
+    uint8_t split;
+    uint8_t host_link;
+};
+static_assert(sizeof(settings_t) + 4 <= SETTINGS_SLOT_SIZE, "settings do not fit in a slot");
+static_assert(SETTINGS_SLOT_SIZE * SETTINGS_SLOTS <= 128, "settings slots do not fit in the EEPROM");
+
+const uint32_t baudrates[] = { 1200, 2400, 4800, 9600, 19200, 115200 };
+#define NBAUDRATES (sizeof(baudrates) / sizeof(baudrates[0]))
+
+cal_point_t touch_cal[3];
+bool touch_calibrated = false;
+
+static settings_t saved_settings;
+static int settings_slot = -1;
+
+// the current settings as a block to be saved
+static void settings_from_config(settings_t& st)
+{
+    memset(&st, 0, sizeof(st));
+    st.magic = SETTINGS_MAGIC;
+    st.version = SETTINGS_VERSION;
+    st.length = sizeof(settings_t) + 4;
+    st.baud = 3;
+    for (uint8_t i = 0; i < NBAUDRATES; i++) {
+        if(baudrates[i] == (uint32_t)baudrate) st.baud = i;
+    }
+    st.rotation = rotation;
+    st.font_size = font_size;
+    st.flags = (local_echo ? SET_LOCAL_ECHO : 0) | (lfcrlf ? SET_LFCRLF : 0) |
+               (crcrlf ? SET_CRCRLF : 0) | (touch_calibrated ? SET_TOUCH_CAL : 0);
+    st.text_color = text_color;
+    memcpy(st.touch_cal, touch_cal, sizeof(touch_cal));
+    st.dim_delay = dim_delay;
+    st.split = split;
+    st.host_link = host_link;
+}
+
+static void config_from_settings(const settings_t& st)
+{
+    baudrate = st.baud < NBAUDRATES ? baudrates[st.baud] : 9600;
+    rotation = st.rotation;
+    font_size = st.font_size;
+    local_echo = (st.flags & SET_LOCAL_ECHO) != 0;
+    lfcrlf = (st.flags & SET_LFCRLF) != 0;
+    crcrlf = (st.flags & SET_CRCRLF) != 0;
+    touch_calibrated = (st.flags & SET_TOUCH_CAL) != 0;
+    text_color = st.text_color;
+    memcpy(touch_cal, st.touch_cal, sizeof(touch_cal));
+    dim_delay = st.dim_delay < NDIMDELAYS ? st.dim_delay : 0;
+    split = st.split < 3 ? st.split : 0;
+    host_link = st.host_link <= LINK_BOTH ? st.host_link : LINK_UART;
+}
+
+void save_settings()
+{
+    settings_t st;
+    settings_from_config(st);
+
+    // nothing changed since the last save, so do not wear the EEPROM
+    if(settings_slot >= 0) {
+        st.seq = saved_settings.seq;
+        if(memcmp(&st, &saved_settings, sizeof(st)) == 0) return;
+    }
+
+    st.seq = saved_settings.seq + 1;
+    settings_slot = (settings_slot + 1) % SETTINGS_SLOTS;
+
+    uint8_t buf[sizeof(settings_t) + 4];
+    memcpy(buf, &st, sizeof(st));
+    uint32_t crc = crc32_update(0, buf, sizeof(st));
+    memcpy(&buf[sizeof(st)], &crc, 4);
+
+    int addr = settings_slot * SETTINGS_SLOT_SIZE;
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        EEPROM.update(addr + i, buf[i]);
+    }
+    saved_settings = st;
+}
+
+// invalidate all the slots so the defaults are used on the next boot
+void clear_settings()
+{
+    for (int i = 0; i < SETTINGS_SLOTS; i++) {
+        EEPROM.update(i * SETTINGS_SLOT_SIZE, 0);
+    }
+    settings_slot = -1;
+}
+
+static bool settings_valid(const uint8_t *slot)
+{
+    const settings_t *st = (const settings_t *)slot;
+    if(st->magic != SETTINGS_MAGIC || st->length < 8 || st->length > SETTINGS_SLOT_SIZE) return false;
+    uint32_t crc;
+    memcpy(&crc, &slot[st->length - 4], 4);
+    return crc == crc32_update(0, slot, st->length - 4);
+}
+
+// read the original fixed layout so existing units keep their settings
+static bool get_legacy_settings()
+{
+    if(EEPROM.read(0) != SETTINGS_LEGACY_MAGIC) return false;
+
+    uint8_t br = EEPROM.read(1);
+    baudrate = br < NBAUDRATES ? baudrates[br] : 9600;
+    rotation = EEPROM.read(2);
+    font_size = EEPROM.read(3);
+    text_color = (EEPROM.read(5) << 8) | EEPROM.read(4);
+    local_echo = EEPROM.read(6) != 0;
+    lfcrlf = EEPROM.read(7) != 0;
+    crcrlf = EEPROM.read(8) != 0;
+    return true;
+}
+
+void get_settings()
+{
+    // read all the slots in one go and use the newest valid one
+    uint8_t slots[SETTINGS_SLOTS][SETTINGS_SLOT_SIZE];
+    EEPROM.get(0, slots);
+
+    int best = -1;
+    for (int i = 0; i < SETTINGS_SLOTS; i++) {
+        if(!settings_valid(slots[i])) continue;
+        // sequence numbers wrap so compare the difference
+        if(best < 0 || (int8_t)(slots[i][3] - slots[best][3]) > 0) best = i;
+    }
+
+    if(best < 0) {
+        if(get_legacy_settings()) {
+            // convert to the new format
             save_settings();
-            tft.println("\r\nSettings saved");
         }
+#ifdef DEBUG
+        else {
+            Serial.println("No settings found in EEPROM");
+        }
+#endif
+        return;
+    }
+
+    // start from the defaults so fields missing from an older block keep them
+    settings_t st;
+    settings_from_config(st);
+    memcpy(&st, slots[best], min((size_t)slots[best][2] - 4, sizeof(st)));
+    config_from_settings(st);
+
+    settings_slot = best;
+    saved_settings = st;
+}
+
+// Settings menu, drawn over the top left of the screen while loop() carries
+// on buffering host output. The screen under it is redrawn from the
+// retained text when it closes.
+#define CONFIG_FONT_W 8         // the menu always uses font scale 0
+#define CONFIG_FONT_H 16
+#define CONFIG_COLS 40
+#define CONFIG_W (CONFIG_COLS * CONFIG_FONT_W + 16)
+#define CONFIG_H ((CFG_ITEMS + 5) * CONFIG_FONT_H + 16)
+
+enum config_item_t {
+    CFG_BAUD, CFG_LINK, CFG_ROTATION, CFG_FONT, CFG_COLOR, CFG_ECHO, CFG_LFCRLF, CFG_CRCRLF, CFG_DIM,
+#ifdef SPLIT
+    CFG_SPLIT,
+#endif
+    CFG_ITEMS
+};
+
+const uint16_t text_colors[] = { RA8875_GREEN, RA8875_WHITE, RA8875_YELLOW, RA8875_CYAN, RA8875_MAGENTA };
+const char *text_color_names[] = { "green", "white", "yellow", "cyan", "magenta" };
+const char *split_names[] = { "off", "stacked", "beside" };
+const char *link_names[] = { "UART", "USB", "both" };
+#define NTEXTCOLORS (sizeof(text_colors) / sizeof(text_colors[0]))
+
+bool config_active = false;
+static uint8_t config_sel;
+static uint8_t config_values[CFG_ITEMS];
+
+static uint8_t config_limit(uint8_t item)
+{
+    switch(item) {
+        case CFG_BAUD:     return NBAUDRATES;
+        case CFG_LINK:     return LINK_BOTH + 1;
+        case CFG_ROTATION: return 2;
+        case CFG_FONT:     return 4;
+        case CFG_COLOR:    return NTEXTCOLORS;
+        case CFG_DIM:      return NDIMDELAYS;
+#ifdef SPLIT
+        case CFG_SPLIT:    return 3;
+#endif
+        default:           return 2;
+    }
+}
+
+static void draw_config()
+{
+    static const char *labels[CFG_ITEMS] = {
+        "Baud rate", "Host link", "Rotation", "Font size", "Text colour", "Local echo", "LF -> CRLF", "CR -> CRLF", "Dim after",
+#ifdef SPLIT
+        "Split screen",
+#endif
+    };
+    char buf[CONFIG_COLS + 1];
+
+    tft.setFontScale(0);
+    tft.fillRect(0, 0, CONFIG_W, CONFIG_H, RA8875_BLACK);
+    tft.drawRect(0, 0, CONFIG_W, CONFIG_H, text_color);
+
+    for (uint8_t i = 0; i < CFG_ITEMS; i++) {
+        uint8_t v = config_values[i];
+        char value[8];
+        switch(i) {
+            case CFG_BAUD:  snprintf(value, sizeof(value), "%lu", (unsigned long)baudrates[v]); break;
+            case CFG_COLOR: snprintf(value, sizeof(value), "%s", text_color_names[v]); break;
+            case CFG_LINK:  snprintf(value, sizeof(value), "%s", link_names[v]); break;
+            case CFG_ROTATION:
+            case CFG_FONT:  snprintf(value, sizeof(value), "%u", v); break;
+            case CFG_DIM:
+                if(v == 0) snprintf(value, sizeof(value), "never");
+                else snprintf(value, sizeof(value), "%u min", dim_minutes[v]);
+                break;
+#ifdef SPLIT
+            case CFG_SPLIT: snprintf(value, sizeof(value), "%s", split_names[v]); break;
+#endif
+            default:        snprintf(value, sizeof(value), "%s", v ? "on" : "off"); break;
+        }
+        snprintf(buf, sizeof(buf), " %-14s < %-7s > ", labels[i], value);
+
+        // highlight the selected item
+        if(i == config_sel) tft.setTextColor(RA8875_BLACK, text_color);
+        else tft.setTextColor(text_color, RA8875_BLACK);
+        tft.setCursor(8, 8 + i * CONFIG_FONT_H);
+        tft.print(buf);
+    }
+
+    tft.setTextColor(text_color, RA8875_BLACK);
+    int16_t y = 8 + (CFG_ITEMS + 1) * CONFIG_FONT_H;
+    tft.setCursor(8, y);
+    tft.print(" up/down select, left/right change");
+    tft.setCursor(8, y + CONFIG_FONT_H);
+    tft.print(" enter apply, s save, r restore");
+    tft.setCursor(8, y + 2 * CONFIG_FONT_H);
+    tft.print(has_touch ? " c calibrate touch, q quit" : " q quit");
+
+    // back to transparent text
+    tft.setTextColor(text_color);
+    tft.setFontScale(font_size);
+}
+
+void config_setup()
+{
+    // the menu is drawn over whatever is on the screen now
+    render_flush();
+    config_active = true;
+    config_sel = 0;
+
+    settings_t st;
+    settings_from_config(st);
+    config_values[CFG_BAUD] = st.baud;
+    config_values[CFG_LINK] = host_link;
+    config_values[CFG_ROTATION] = rotation;
+    config_values[CFG_FONT] = font_size;
+    config_values[CFG_COLOR] = 0;
+    for (uint8_t i = 0; i < NTEXTCOLORS; i++) {
+        if(text_colors[i] == text_color) config_values[CFG_COLOR] = i;
+    }
+    config_values[CFG_ECHO] = local_echo;
+    config_values[CFG_LFCRLF] = lfcrlf;
+    config_values[CFG_CRCRLF] = crcrlf;
+    config_values[CFG_DIM] = dim_delay;
+#ifdef SPLIT
+    config_values[CFG_SPLIT] = split;
+#endif
+
+    draw_config();
+}
+
+// close the menu, applying the edited values if apply is set
+void config_close(bool apply)
+{
+    config_active = false;
+
+    bool new_geometry = false, new_layout = false;
+    if(apply) {
+        new_geometry = rotation != config_values[CFG_ROTATION] || font_size != config_values[CFG_FONT];
+        bool new_ports = baudrates[config_values[CFG_BAUD]] != (uint32_t)baudrate;
+#ifdef SPLIT
+        if(split != config_values[CFG_SPLIT]) {
+            // leave the alternate screen while it is still a screen
+            set_alt_screen(false, false);
+            split = config_values[CFG_SPLIT];
+            focus = 0;
+            new_layout = new_ports = true;
+        }
+#endif
+        baudrate = baudrates[config_values[CFG_BAUD]];
+        if(new_ports) begin_ports();
+        rotation = config_values[CFG_ROTATION];
+        font_size = config_values[CFG_FONT];
+        text_color = text_colors[config_values[CFG_COLOR]];
+        local_echo = config_values[CFG_ECHO];
+        lfcrlf = config_values[CFG_LFCRLF];
+        crcrlf = config_values[CFG_CRCRLF];
+        dim_delay = config_values[CFG_DIM];
+        if(host_link != config_values[CFG_LINK]) {
+            host_link = config_values[CFG_LINK];
+            use_link(host_link == LINK_USB ? &Serial : &Serial1);
+        }
+        tft.setTextColor(text_color);
+    }
+
+    if(new_layout || (new_geometry && split)) {
+        // panes are not reflowed, they start again empty
+        tft.setRotation(rotation);
+        tft.setFontScale(font_size);
+        set_geometry();
+        repaint_all();
+    } else if(new_geometry) {
+        // the saved main screen would not fit the alternate one, so go
+        // back to the main screen and fit its text to the new size
+        set_alt_screen(false, false);
+        tft.setRotation(rotation);
+        tft.setFontScale(font_size);
+        reflow_screen();
+    } else {
+        redraw_rows(0, (CONFIG_H - 1) / char_height);
+    }
+}
 
-        done= true;
+// handle a key while the menu is up
+void config_key(uint8_t c)
+{
+    uint8_t& v = config_values[config_sel];
+    switch(c) {
+        case 0x81: // up
+            config_sel = config_sel == 0 ? CFG_ITEMS - 1 : config_sel - 1;
+            break;
+        case 0x82: // down
+            config_sel = (config_sel + 1) % CFG_ITEMS;
+            break;
+        case 0x83: // left
+            v = v == 0 ? config_limit(config_sel) - 1 : v - 1;
+            break;
+        case 0x84: // right
+            v = (v + 1) % config_limit(config_sel);
+            break;
+        case '\r':
+            config_close(true);
+            return;
+        case 's':
+            config_close(true);
+            save_settings();
+            return;
+        case 'r':
+            // defaults are used from the next boot
+            clear_settings();
+            config_close(false);
+            return;
+#ifdef USETOUCH
+        case 'c':
+            if(has_touch) {
+                touch_calibrate();
+                redraw_rows(0, grid_rows - 1);
+            }
+            break;
+#endif
+        case 'q':
+        case 27:
+        case 0x85: // the today key toggles the menu
+            config_close(false);
+            return;
+        default:
+            return;
     }
-
-    tft.println("\r\nDone");
+    draw_config();
 }
 
 void setup()
@@ -238,19 +1505,25 @@ void setup()
 
     Serial1.setRX(3);
     Serial1.setTX(4);
-    Serial1.begin(baudrate, SERIAL_8N1); // for I/O
+    begin_ports(); // for I/O
+    if(host_link == LINK_USB) use_link(&Serial);
     // Serial1.println("Hello world!");
 
     tft.begin(RA8875_800x480);
     tft.setRotation(rotation);
 
+    // Two layers for the alternate screen. The RA8875 only has the memory
+    // for two 800x480 layers at 8 bits a pixel, so this drops the whole
+    // terminal to 8 bit (RGB332) colour, text colours included.
+    tft.useLayers(true);
+    tft.writeTo(L1);
+    tft.layerEffect(LAYER1);
+
     tft.setFontScale(font_size); //font x1
+    glyphs_setup();
 
 
-    screen_width = tft.width();
-    screen_height = tft.height();
-    char_width = tft.getFontWidth();
-    char_height = tft.getFontHeight();
+    set_geometry();
 
 #ifdef DEBUG
     Serial.printf("Screen width: %u, height: %u\n", screen_width, screen_height);
@@ -275,6 +1548,14 @@ void setup()
     pinMode(LED, OUTPUT);
     digitalWrite(LED, 0);
 
+#if defined(FLASHFW) || defined(VERIFYFW)
+    // talk to flashfw.py over USB, does not return
+    capacity = flash.begin();
+    tft.printf("Flash programming mode, capacity %lu\n", capacity);
+    digitalWrite(LED, capacity > 0);
+    flash_programmer(capacity);
+#endif
+
 #ifdef USETOUCH
     capacity = flash.begin();
 #ifdef DEBUG
@@ -282,8 +1563,13 @@ void setup()
 #endif
     if(capacity > 0) {
         digitalWrite(LED, 1);
-        load_touch_fw();
-        has_touch = true;
+        has_touch = load_touch_fw();
+        if(has_touch) {
+            if(touch_calibrated) touch_cal_compute(touch_cal);
+#ifdef DEBUG
+            touch_benchmark();
+#endif
+        }
 
     } else {
 #ifdef DEBUG
@@ -295,6 +1581,12 @@ void setup()
     }
 #endif
 
+#ifdef FLIGHTREC
+    // record what the host sends
+    if(capacity == 0) capacity = flash.begin();
+    flightrec_setup(capacity);
+#endif
+
     // set text color to green
     tft.setTextColor(text_color);
     tft.setCursor(0, 0);
@@ -342,300 +1634,854 @@ struct _ts_event {
     struct _coord coords[5];
 };
 
-#include "RingBuffer.h"
-using touch_event_t = struct _ts_event;
-template<class T> using touch_events_t = RingBuffer<T, 16>;
-touch_events_t<touch_event_t> touch_events;
+// only the first finger is used, so just that is queued, 12 bit raw
+// coordinates instead of the 64 byte report from the controller
+struct touch_point_t {
+    uint16_t x, y;
+};
+
+struct touch_event_t {
+    uint8_t n_fingers;
+    touch_point_t pos;
+};
+
+RingBuffer<touch_event_t, TOUCH_EVENTS_SIZE> touch_events;
 enum touch_state_t { UP, DOWN };
 touch_state_t touch_state = UP;
 bool moved = false;
 
 extern "C" void add_touch_event(struct _ts_event *e)
 {
-    touch_events.push_back(*e);
+    touch_event_t t;
+    t.n_fingers = e->n_fingers;
+    t.pos.x = e->coords[0].x;
+    t.pos.y = e->coords[0].y;
+    touch_events.push_back(t);
+    activity();
 }
 
-int tog = 0;
-uint32_t fc = 0, time = 0;
-int max_depth = 0;
-uint32_t lastx, lasty;
-struct _coord last_coords[5] = {0};
-int nf = 0;
-bool last_finger_down[5] = {false};
-#endif
+// gesture recogniser, turns the raw touch reports into taps, drags and swipes
+// working in character cells
+#define TOUCH_MAX_X 800             // touch panel resolution in landscape
+#define TOUCH_MAX_Y 480
+#define TOUCH_EVENTS_PER_LOOP 2     // touch reports handled per loop(), keeps output latency bounded
+#define TAP_MAX_MS 300              // longest press that is still a tap
+#define TAP_SLOP 1                  // cells a press may wander and still be a tap
+#define SWIPE_MAX_MS 400            // faster than this is a swipe, slower is a drag to select
+#define SWIPE_MIN_ROWS 3            // shortest vertical swipe
+#define BTEROP_NOT_DEST 0x50        // BTE raster op ~D, used to invert the selection
+
+struct touch_cell_t { int16_t col, row; };
+touch_cell_t down_cell, last_cell;
+uint32_t down_time = 0;
+bool selecting = false;
+bool selection_shown = false;
+touch_cell_t sel_start, sel_end;
+// the pane the selection is in, output to the other one can clear it
+static const pane_t *sel_pane;
+
+// convert landscape display pixels to the current rotation
+static void landscape_to_screen(int16_t& x, int16_t& y)
+{
+    if(rotation == 1) {
+        int16_t t = x;
+        x = y;
+        y = (TOUCH_MAX_X - 1) - t;
+    }
+}
 
-// wait for char and return it
-char getcharw()
+// raw touch coordinates are filtered and calibrated to landscape pixels
+static touch_cell_t touch_to_cell(const touch_point_t& c)
 {
-#ifdef DEBUG
-    while(true) {
-        if (Serial1.available()) {
-            return Serial1.read();
-        }
-        if (Serial.available()) {
-            return Serial.read();
+    int16_t x, y;
+    touch_transform(c.x, c.y, x, y);
+    landscape_to_screen(x, y);
+
+    // cells of the pane with the focus
+    touch_cell_t cell;
+    cell.col = constrain(x / char_width - pane->col, 0, screen_cols - 1);
+    cell.row = constrain(y / char_height - pane->row, 0, screen_rows - 1);
+    return cell;
+}
+
+// invert the cells of the selection's pane between the two points in
+// reading order
+static void invert_cells(touch_cell_t a, touch_cell_t b)
+{
+    if(b.row < a.row || (b.row == a.row && b.col < a.col)) {
+        touch_cell_t t = a; a = b; b = t;
+    }
+    for (int16_t r = a.row; r <= b.row; r++) {
+        int16_t c0 = (r == a.row) ? a.col : 0;
+        int16_t c1 = (r == b.row) ? b.col : sel_pane->cols - 1;
+        int16_t x = (sel_pane->col + c0) * char_width;
+        int16_t y = (sel_pane->row + r) * char_height;
+        tft.BTE_move(x, y, (c1 - c0 + 1) * char_width, char_height, x, y, 0, 0, false, BTEROP_NOT_DEST);
+    }
+}
+
+// remove the selection highlight, must be done before anything else is drawn
+void clear_selection()
+{
+    if(selection_shown) {
+        invert_cells(sel_start, sel_end);
+        selection_shown = false;
+    }
+    selecting = false;
+}
+
+// Tap to position sends a cursor key for each column, which can be more
+// than the transmit buffer holds. What does not fit is sent from loop() as
+// the buffer drains rather than waiting here, a new tap replaces it.
+static Stream *keys_port;
+static const char *keys_seq;
+static uint16_t keys_left = 0;
+
+static void send_pending_keys()
+{
+    if(keys_left == 0) return;
+    int len = strlen(keys_seq);
+    while(keys_left > 0 && keys_port->availableForWrite() >= len) {
+        keys_port->write((const uint8_t *)keys_seq, len);
+        --keys_left;
+    }
+}
+
+static void send_keys(const char *seq, uint16_t n)
+{
+    keys_port = port;
+    keys_seq = seq;
+    keys_left = n;
+    send_pending_keys();
+}
+
+static void on_tap(touch_cell_t cell)
+{
+    clear_selection();
+
+    // tap to position, only along the cursor line as vertical cursor keys
+    // would be history in a shell
+    if(cell.row != cursor_row) return;
+
+    int16_t n = cell.col - cursor_col;
+    if(n > 0) send_keys("\x1B[C", n);
+    else if(n < 0) send_keys("\x1B[D", -n);
+}
+
+static void on_drag(touch_cell_t cell)
+{
+    if(!selecting) {
+        clear_selection();
+        // the highlight is drawn over the screen as it is now
+        render_flush();
+        selecting = true;
+        sel_pane = pane;
+        sel_start = down_cell;
+    } else if(selection_shown) {
+        // remove the old highlight before drawing the new one
+        invert_cells(sel_start, sel_end);
+    }
+    sel_end = cell;
+    invert_cells(sel_start, sel_end);
+    selection_shown = true;
+}
+
+static void on_swipe(int16_t rows)
+{
+    // there is no local scrollback, so ask the host application to page
+    // finger moving down shows earlier text
+    clear_selection();
+    port->print(rows > 0 ? "\x1B[5~" : "\x1B[6~");
+}
+
+static void touch_down(const touch_point_t& c)
+{
+    if(touch_state == UP) touch_filter_reset();
+    touch_cell_t cell = touch_to_cell(c);
+    if(touch_state == UP) {
+        touch_state = DOWN;
+        moved = false;
+        down_cell = last_cell = cell;
+        down_time = millis();
+        return;
+    }
+
+    if(abs(cell.col - down_cell.col) > TAP_SLOP || abs(cell.row - down_cell.row) > TAP_SLOP) {
+        moved = true;
+    }
+
+    // a slow move is a drag, until then it may still turn out to be a swipe
+    bool changed = cell.col != last_cell.col || cell.row != last_cell.row;
+    if(moved && (selecting ? changed : millis() - down_time >= SWIPE_MAX_MS)) {
+        on_drag(cell);
+    }
+    last_cell = cell;
+}
+
+static void touch_up()
+{
+    uint32_t duration = millis() - down_time;
+    touch_state = UP;
+
+    if(selecting) {
+        // leave the selection shown until the next tap or output
+        selecting = false;
+
+    } else if(!moved) {
+        if(duration <= TAP_MAX_MS) on_tap(down_cell);
+
+    } else if(duration < SWIPE_MAX_MS && abs(last_cell.row - down_cell.row) >= SWIPE_MIN_ROWS) {
+        on_swipe(last_cell.row - down_cell.row);
+    }
+}
+
+// show three targets in turn and record the raw position of each touch
+bool touch_calibrate()
+{
+    cal_point_t raw[3];
+    clear_selection();
+    touch_state = UP;
+
+    for (int i = 0; i < 3; i++) {
+        int16_t x = cal_targets[i].x, y = cal_targets[i].y;
+        landscape_to_screen(x, y);
+        // the retained text is left alone so the screen can be redrawn afterwards
+        tft.fillWindow(RA8875_BLACK);
+        tft.setCursor(0, 0);
+        tft.println("Touch the target");
+        tft.drawFastHLine(x - 10, y, 21, text_color);
+        tft.drawFastVLine(x, y - 10, 21, text_color);
+        tft.drawCircle(x, y, 6, text_color);
+
+        // average the raw reports for as long as the finger is down
+        uint32_t sx = 0, sy = 0, n = 0;
+        uint32_t start = millis();
+        while(millis() - start < 10000) {
+            // give up if host output is about to overflow, loop() then
+            // closes the menu and shows it as it does while the menu is up
+            if(!buffer_input()) return false;
+            gsl_poll();
+            if(touch_events.empty()) continue;
+            touch_event_t e = touch_events.pop_front();
+            if(e.n_fingers > 0) {
+                sx += e.pos.x;
+                sy += e.pos.y;
+                n++;
+            } else if(n > 0) {
+                break;
+            }
         }
+        if(n == 0) return false;
+        raw[i].x = sx / n;
+        raw[i].y = sy / n;
     }
-#else
-    while (!Serial1.available()) ;
-    return Serial1.read();
-#endif
+
+    if(!touch_cal_compute(raw)) return false;
+    memcpy(touch_cal, raw, sizeof(touch_cal));
+    touch_calibrated = true;
+    save_settings();
+    return true;
 }
 
-void scroll_up()
+// send an xterm mouse report for the cell, button 0 is the finger
+// press is 0, motion while pressed is 32, release is 3 (or 0 with the SGR final 'm')
+static void send_mouse_report(uint8_t button, touch_cell_t cell, bool release)
 {
-    tft.BTE_move(0, char_height, screen_width, screen_height - char_height, 0, 0);
-    delay(50);
-    tft.fillRect(0, screen_height - char_height, screen_width, char_height, RA8875_BLACK);
+    char buf[24];
+    if(mouse_sgr) {
+        snprintf(buf, sizeof(buf), "\x1B[<%u;%d;%d%c", button, cell.col + 1, cell.row + 1, release ? 'm' : 'M');
+        port->print(buf);
+    } else {
+        // X10 encoding can only report up to cell 223
+        if(release) button = 3;
+        port->print("\x1B[M");
+        port->write(32 + button);
+        port->write(32 + min(cell.col + 1, 223));
+        port->write(32 + min(cell.row + 1, 223));
+    }
 }
 
-void scroll_down()
+#define MOUSE_MOTION_MS 50  // shortest time between motion reports
+
+// when the host has mouse tracking on touches are sent as mouse reports
+// instead of being recognised as gestures
+static void mouse_touch(bool down, const touch_point_t& c)
+{
+    static uint32_t last_motion = 0;
+
+    if(!down) {
+        if(touch_state == DOWN) send_mouse_report(0, last_cell, true);
+        touch_state = UP;
+        return;
+    }
+
+    if(touch_state == UP) touch_filter_reset();
+    touch_cell_t cell = touch_to_cell(c);
+    if(touch_state == UP) {
+        touch_state = DOWN;
+        last_cell = cell;
+        send_mouse_report(0, cell, false);
+        return;
+    }
+
+    // motion only for 1002, only when it moves to another cell and not too often
+    // as a finger drag would otherwise flood a slow link
+    if(mouse_mode != 1002) return;
+    if(cell.col == last_cell.col && cell.row == last_cell.row) return;
+    if(millis() - last_motion < MOUSE_MOTION_MS) return;
+
+    last_motion = millis();
+    last_cell = cell;
+    send_mouse_report(32, cell, false);
+}
+
+#ifdef SPLIT
+// a press in the other pane moves the keyboard and touch to it, returns
+// true if it did
+static bool touch_focus(const touch_point_t& c)
+{
+    int16_t x, y;
+    touch_filter_reset();
+    touch_transform(c.x, c.y, x, y);
+    landscape_to_screen(x, y);
+    int16_t col = x / char_width, row = y / char_height;
+
+    for (uint8_t i = 0; i < SESSIONS; i++) {
+        const pane_t& p = panes[i];
+        if(i == focus || col < p.col || col >= p.col + p.cols || row < p.row || row >= p.row + p.rows) continue;
+        clear_selection();
+        focus = i;
+        switch_session(i);
+        return true;
+    }
+    return false;
+}
+#endif
+
+// consume queued touch reports, only the latest position of a drag is used
+void process_touch()
 {
-    tft.BTE_move(screen_width - 1, screen_height - char_height - 1, screen_width, screen_height - char_height, screen_width - 1, screen_height - 1, 0, 0, false, RA8875_BTEROP_SOURCE, false, true);
-    delay(50);
-    tft.fillRect(0, 0, screen_width, char_height, RA8875_BLACK);
+    for (int n = 0; n < TOUCH_EVENTS_PER_LOOP && !touch_events.empty(); ) {
+        touch_event_t e = touch_events.pop_front();
+        bool down = e.n_fingers > 0;
+#ifdef SPLIT
+        // a press that moves the focus does nothing else, the rest of it up
+        // to the release is dropped rather than taken as a tap or a drag
+        static bool focus_press = false;
+        if(split && down && touch_state == UP && !focus_press) focus_press = touch_focus(e.pos);
+        if(focus_press) {
+            if(!down) focus_press = false;
+            n++;
+            continue;
+        }
+#endif
+
+        // skip intermediate positions while the finger stays down
+        if(down && touch_state == DOWN && !touch_events.empty() && touch_events.peek_front().n_fingers > 0) continue;
+
+        if(mouse_mode != 0) mouse_touch(down, e.pos);
+        else if(down) touch_down(e.pos);
+        else if(touch_state == DOWN) touch_up();
+        n++;
+    }
 }
+#endif
 
 void move_cursor(char dir, int n)
 {
-    int16_t currentX, currentY;
-    tft.getCursor(currentX, currentY);
-    int16_t x = currentX, y = currentY;
+    int16_t col = cursor_col, row = cursor_row;
     switch(dir) {
         case 'A':
             // moves cursor up n lines
-            y = currentY - (n * char_height);
-            if(y < 0) y = 0;
+            row -= n;
             break;
 
         case 'B':
             // moves cursor down n lines
-            y = currentY + (n * char_height);
-            if(y >= screen_height) y = screen_height - char_height;
+            row += n;
             break;
 
         case 'C':
             // cursor right n characters
-            x = currentX + (n * char_width);
-            if(x >= screen_width) x = screen_width - char_width;
+            col += n;
             break;
 
         case 'D':
             // moves cursor left n characters
-            x = currentX - (n * char_width);
-            if(x < 0) x = 0;
+            col -= n;
             break;
 
         case 'E':
             // moves cursor to start of n next lines
-            x = 0;
-            y = currentY + (n * char_height);
-            if(y >= screen_height) y = screen_height - char_height;
+            col = 0;
+            row += n;
             break;
 
         case 'F':
             // moves cursor to start of n previous lines
-            x = 0;
-            y = currentY - (n * char_height);
-            if(y < 0) y = 0;
+            col = 0;
+            row -= n;
             break;
 
         case 'G':
             // moves cursor to column n
-            --n;
-            x = (n * char_width);
-            if(x >= screen_width) x = screen_width - char_width;
+            col = n - 1;
+            break;
+    }
+
+    cursor_col = constrain(col, 0, screen_cols - 1);
+    cursor_row = constrain(row, 0, screen_rows - 1);
+    wrap_pending = false;
+}
+
+void set_private_mode(uint16_t mode, bool set)
+{
+    switch(mode) {
+        case 7:
+            // DECAWM
+            autowrap = set;
+            wrap_pending = false;
+            break;
+
+        case 47:
+        case 1047:
+            set_alt_screen(set, false);
+            break;
+
+        case 1049:
+            // also saves and restores the cursor
+            set_alt_screen(set, true);
+            break;
+
+        case 1000:
+        case 1002:
+            // switching tracking off turns off whichever mode is on
+            if(set) mouse_mode = mode;
+            else mouse_mode = 0;
             break;
+
+        case 1006:
+            mouse_sgr = set;
+            break;
+    }
+}
+
+// The escape sequence parser is a state machine fed one character at a
+// time, so it never waits for the rest of a sequence to arrive.
+enum parse_state_t { GROUND, ESCAPE, CSI_ENTRY, CSI_PARAM, DESIGNATE };
+static parse_state_t parse_state = GROUND;
+static uint16_t escParam[2];
+static uint8_t nParam;
+static bool privateMode;
+
+// G0 and G1 character sets, set to DEC special graphics by Esc(0 and Esc)0,
+// back to ASCII by Esc(B and Esc)B. SI shifts to G0 and SO to G1
+static bool graphics_set[2] = { false, false };
+static uint8_t shift_set = 0, designate_set;
+
+// UTF-8 sequence being decoded, utf8_need is the number of bytes still to come
+static uint32_t utf8_cp;
+static uint8_t utf8_need = 0;
+
+// the state of a session while another one is being parsed
+struct session_t {
+    uint16_t cursor_col = 0, cursor_row = 0;
+    bool wrap_pending = false, autowrap = true;
+    saved_cursor_t saved_cursor = { 0, 0 };
+    parse_state_t parse_state = GROUND;
+    uint16_t escParam[2];
+    uint8_t nParam;
+    bool privateMode;
+    bool graphics_set[2] = { false, false };
+    uint8_t shift_set = 0, designate_set;
+    uint32_t utf8_cp;
+    uint8_t utf8_need = 0;
+    uint16_t mouse_mode = 0;
+    bool mouse_sgr = false;
+};
+static session_t sessions[SESSIONS];
+static uint8_t session = 0; // the one in the globals
+
+// make session i the one that parsing and drawing the cursor work on
+void switch_session(uint8_t i)
+{
+    if(i == session) return;
+
+    session_t& s = sessions[session];
+    s.cursor_col = cursor_col;
+    s.cursor_row = cursor_row;
+    s.wrap_pending = wrap_pending;
+    s.autowrap = autowrap;
+    s.saved_cursor = saved_cursor;
+    s.parse_state = parse_state;
+    memcpy(s.escParam, escParam, sizeof(escParam));
+    s.nParam = nParam;
+    s.privateMode = privateMode;
+    memcpy(s.graphics_set, graphics_set, sizeof(graphics_set));
+    s.shift_set = shift_set;
+    s.designate_set = designate_set;
+    s.utf8_cp = utf8_cp;
+    s.utf8_need = utf8_need;
+    s.mouse_mode = mouse_mode;
+    s.mouse_sgr = mouse_sgr;
+
+    session = i;
+    const session_t& n = sessions[i];
+    cursor_col = n.cursor_col;
+    cursor_row = n.cursor_row;
+    wrap_pending = n.wrap_pending;
+    autowrap = n.autowrap;
+    saved_cursor = n.saved_cursor;
+    parse_state = n.parse_state;
+    memcpy(escParam, n.escParam, sizeof(escParam));
+    nParam = n.nParam;
+    privateMode = n.privateMode;
+    memcpy(graphics_set, n.graphics_set, sizeof(graphics_set));
+    shift_set = n.shift_set;
+    designate_set = n.designate_set;
+    utf8_cp = n.utf8_cp;
+    utf8_need = n.utf8_need;
+    mouse_mode = n.mouse_mode;
+    mouse_sgr = n.mouse_sgr;
+
+    pane = &panes[i];
+    screen_cols = pane->cols;
+    screen_rows = pane->rows;
+    port = ports[i];
+}
+
+// handle the final character of an Esc[ sequence
+static void csi_dispatch(char c)
+{
+    uint16_t escParam1 = escParam[0];
+    uint16_t escParam2 = escParam[1];
+
+#ifdef DEBUG
+    Serial.printf("Esc[ escP1: %d, escP2: %d, %c\n", escParam1, escParam2, c);
+#endif
+
+    if (privateMode) {
+        // Esc[?nh sets and Esc[?nl resets DEC private mode n, two modes may be given
+        if (c == 'h' || c == 'l') {
+            set_private_mode(escParam1, c == 'h');
+            if (escParam2 > 0) set_private_mode(escParam2, c == 'h');
+        }
+    }
+    else if(c >= 'A' && c <= 'G') {
+        // Handle cursor incremental move commands
+        if (escParam1 < 1) escParam1 = 1;
+        // Esc[nA moves cursor up n lines
+        // Esc[nB moves cursor down n lines
+        // Esc[nC moves cursor right n characters
+        // Esc[nD moves cursor left n characters
+        // Esc[nE moves cursor to start of n next lines
+        // Esc[nF moves cursor to start of n previous lines
+        // Esc[nG moves cursor to column n
+        move_cursor(c, escParam1);
+    }
+    // Esc[line;ColumnH or Esc[line;Columnf moves cursor to that coordinate
+    else if (c == 'H' || c == 'f') {
+        if (escParam1 > 0) {
+            escParam1--;
+        }
+        if (escParam2 > 0) {
+            escParam2--;
+        }
+        cursor_row = min(escParam1, (uint16_t)(screen_rows - 1));
+        cursor_col = min(escParam2, (uint16_t)(screen_cols - 1));
+        wrap_pending = false;
+    }
+    //Esc[J=clear from cursor down, Esc[1J=clear from cursor up, Esc[2J=clear complete screen
+    else if (c == 'J') {
+        wrap_pending = false;
+        if (escParam1 == 0) {
+            // clear to end of line, then to end of screen
+            erase_cells(cursor_row, cursor_col, screen_cols - 1);
+            erase_rows(cursor_row + 1, screen_rows - 1);
+
+        } else if (escParam1 == 1) {
+            // clear to start of line, then to start of screen
+            erase_cells(cursor_row, 0, cursor_col);
+            if(cursor_row > 0) erase_rows(0, cursor_row - 1);
+
+        } else if (escParam1 == 2) {
+            uint16_t col = cursor_col, row = cursor_row;
+            clear_screen();
+            // the cursor does not move
+            cursor_col = col;
+            cursor_row = row;
+        }
+    }
+    // Esc[K = erase to end of line, Esc[1K = erase to start of line
+    else if (c == 'K') {
+        wrap_pending = false;
+        if (escParam1 == 0) {
+            // clear to end of line
+            erase_cells(cursor_row, cursor_col, screen_cols - 1);
+
+        } else if (escParam1 == 1) {
+            // clear to start of line
+            erase_cells(cursor_row, 0, cursor_col);
+
+        } else if (escParam1 == 2) {
+            // clear entire line
+            erase_cells(cursor_row, 0, screen_cols - 1);
+        }
+
+    }
+    // Esc[nT = scroll down. optional n is number of lines to scroll
+    else if (c == 'T') {
+        if (escParam1 == 0) escParam1 = 1;
+        scroll_cells(-(int16_t)escParam1);
+    }
+    // Esc[nS = scroll up. optional n is number of lines to scroll
+    else if (c == 'S') {
+        if (escParam1 == 0) escParam1 = 1;
+        scroll_cells(escParam1);
+    }
+    // Esc[18t = report the screen size in characters
+    else if (c == 't') {
+        if (escParam1 == 18) send_size_report();
+    }
+    // Esc[s = save cursor, Esc[u = restore cursor
+    else if (c == 's') {
+        save_cursor(saved_cursor);
+    }
+    else if (c == 'u') {
+        restore_cursor(saved_cursor);
+    }
+}
+
+// handle the character after an Esc
+static void esc_dispatch(char c)
+{
+    // Esc7 save cursor, Esc8 restore cursor
+    if (c == '7') {
+        save_cursor(saved_cursor);
+    }
+    else if (c == '8') {
+        restore_cursor(saved_cursor);
+    }
+    // EscM scroll up
+    else if (c == 'M') {
+        scroll_up();
+    }
+    // EscL scroll down
+    else if (c == 'L') {
+        scroll_down();
+    }
+}
+
+// move to the next line, scroll if at the bottom
+static void line_feed()
+{
+    if(cursor_row + 1 >= screen_rows) scroll_up();
+    else ++cursor_row;
+}
+
+// store printable characters at the cursor, wrap and scroll if hit end of screen
+static void put_run(const char *p, size_t n)
+{
+    while(n > 0) {
+        if(wrap_pending) {
+            wrap_pending = false;
+            row_wrapped[pane->row + cursor_row] = true;
+            cursor_col = 0;
+            line_feed();
+        }
+
+        uint16_t k = min(n, (size_t)(screen_cols - cursor_col));
+        memcpy(&cell_row(cursor_row)[cursor_col], p, k);
+        mark_dirty(cursor_row, cursor_col, cursor_col + k - 1);
+        p += k;
+        n -= k;
+
+        if(cursor_col + k < screen_cols) {
+            cursor_col += k;
+        } else {
+            // at the right margin the cursor stays on the last column
+            cursor_col = screen_cols - 1;
+            if(autowrap) {
+                wrap_pending = true;
+            } else if(n > 0) {
+                // without wrap only the last character remains in the last column
+                p += n - 1;
+                n = 1;
+            }
+        }
     }
+}
 
-    tft.setCursor(x, y);
+// store the glyph for a decoded character, 0 takes no cell
+static void put_glyph(uint8_t g)
+{
+    if(g != 0) put_run((const char *)&g, 1);
 }
 
 // do some basic VT100/ansi escape sequence handling
 void process(char data)
 {
-    int16_t currentX, currentY;
+#ifdef USETOUCH
+    if(selection_shown) clear_selection();
+#endif
+    switch(parse_state) {
+        case GROUND:
+            break;
+
+        case ESCAPE:
+            if (data == '[') {
+                escParam[0] = escParam[1] = 0;
+                nParam = 0;
+                privateMode = false;
+                parse_state = CSI_ENTRY;
+            } else if (data == '(' || data == ')') {
+                designate_set = data == ')';
+                parse_state = DESIGNATE;
+            } else {
+                parse_state = GROUND;
+                esc_dispatch(data);
+            }
+            return;
+
+        case DESIGNATE:
+            graphics_set[designate_set] = data == '0';
+            parse_state = GROUND;
+            return;
+
+        case CSI_ENTRY:
+            parse_state = CSI_PARAM;
+            // Esc[? introduces DEC private modes
+            if (data == '?') {
+                privateMode = true;
+                return;
+            }
+            // fall through
+
+        case CSI_PARAM:
+            if (data >= '0' && data <= '9') {
+                // parameters stop at four digits, as private modes go up to 1049
+                if (nParam < 2 && escParam[nParam] < 1000) escParam[nParam] = escParam[nParam] * 10 + (data - '0');
+            } else if (data == ';') {
+                // only two parameters are used, any more are ignored
+                if (nParam < 2) ++nParam;
+            } else {
+                parse_state = GROUND;
+                csi_dispatch(data);
+            }
+            return;
+    }
+
+    if (utf8_need > 0) {
+        if ((data & 0xC0) == 0x80) {
+            utf8_cp = (utf8_cp << 6) | (data & 0x3F);
+            if (--utf8_need == 0) put_glyph(glyph_for(utf8_cp));
+            return;
+        }
+        // the sequence was cut short, this byte starts something new
+        utf8_need = 0;
+        put_glyph(GLYPH_REPLACEMENT);
+    }
+
+    // the cursor moves so any pending wrap is dropped
+    if (data == '\r' || data == '\n' || data == 8) wrap_pending = false;
+
     if (data == '\r') {
         // start of current line
-        tft.getCursor(currentX, currentY);
-        int16_t x = 0;
-        int16_t y = currentY;
-        if(crcrlf) y += char_height; // if CR is converted to CRLF
-        tft.setCursor(x, y);
+        cursor_col = 0;
+        if(crcrlf) line_feed(); // if CR is converted to CRLF
 
     } else if (data == '\n') {
         // next line, potentially scroll
-        tft.getCursor(currentX, currentY);
-        int16_t x = currentX;
-        int16_t y = currentY + char_height;
-        if(y >= screen_height) {
-            scroll_up();
-            y = screen_height - char_height;
-        }
-        if(lfcrlf) x = 0; // if LF is converted to CRLF
-        tft.setCursor(x, y);
+        line_feed();
+        if(lfcrlf) cursor_col = 0; // if LF is converted to CRLF
 
     } else if (data == 8) { // BS
         // backspace move cursor left one
-        tft.getCursor(currentX, currentY);
-        uint16_t x = currentX - char_width;
-        if(x < 0) x = 0;
-        tft.setCursor(x, currentY);
+        if(cursor_col > 0) --cursor_col;
 
     } else if (data == 27) { // ESC
-        //If it is an escape character then get the following characters to interpret
-        //them as an ANSI escape sequence
-        uint8_t escParam1 = 0;
-        uint8_t escParam2 = 0;
-        char serInChar = getcharw();
-
-        if (serInChar == '[') {
-            serInChar = getcharw();
-            // Process a number after the "[" character
-            while (serInChar >= '0' && serInChar <= '9') {
-                serInChar = serInChar - '0';
-                if (escParam1 < 100) {
-                    escParam1 = escParam1 * 10;
-                    escParam1 = escParam1 + serInChar;
-                }
-                serInChar = getcharw();
-            }
-            // If a ";" then process the next number
-            if (serInChar == ';') {
-                serInChar = getcharw();
-                while (serInChar >= '0' && serInChar <= '9') {
-                    serInChar = serInChar - '0';
-                    if (escParam2 < 100) {
-                        escParam2 = escParam2 * 10;
-                        escParam2 = escParam2 + serInChar;
-                    }
-                    serInChar = getcharw();
-                }
-            }
-
-#ifdef DEBUG
-            Serial.printf("Esc[ escP1: %d, escP2: %d, %c\n", escParam1, escParam2, serInChar);
-#endif
-
-            if(serInChar >= 'A' && serInChar <= 'G') {
-                // Handle cursor incremental move commands
-                tft.getCursor(currentX, currentY);
-                if (escParam1 < 1) escParam1 = 1;
-                // Esc[nA moves cursor up n lines
-                // Esc[nB moves cursor down n lines
-                // Esc[nC moves cursor right n characters
-                // Esc[nD moves cursor left n characters
-                // Esc[nE moves cursor to start of n next lines
-                // Esc[nF moves cursor to start of n previous lines
-                // Esc[nG moves cursor to column n
-                move_cursor(serInChar, escParam1);
-            }
-            // Esc[line;ColumnH or Esc[line;Columnf moves cursor to that coordinate
-            else if (serInChar == 'H' || serInChar == 'f') {
-                if (escParam1 > 0) {
-                    escParam1--;
-                }
-                if (escParam2 > 0) {
-                    escParam2--;
-                }
-                int16_t x = escParam1 * char_width;
-                int16_t y = escParam2 * char_height;
-                tft.setCursor(x, y);
-            }
-            //Esc[J=clear from cursor down, Esc[1J=clear from cursor up, Esc[2J=clear complete screen
-            else if (serInChar == 'J') {
-                tft.getCursor(currentX, currentY);
-                if (escParam1 == 0) {
-                    if(currentX != 0) {
-                        // clear to end of line
-                        int16_t x = currentX;
-                        int16_t y = currentY;
-                        int16_t w = screen_width - currentX;
-                        int16_t h = char_height;
-                        tft.fillRect(x, y, w, h, RA8875_BLACK);
-                    }
-                    // clear to end of screen
-                    int16_t y = currentY + char_height;
-                    tft.fillRect(0, y, screen_width, screen_height - y, RA8875_BLACK);
-
-                } else if (escParam1 == 1) {
-                    if(currentX != 0) {
-                        // clear to start of line
-                        int16_t y = currentY;
-                        int16_t w = currentX;
-                        int16_t h = char_height;
-                        tft.fillRect(0, y, w, h, RA8875_BLACK);
-                    }
-                    // clear to start of screen
-                    int16_t y = currentY - char_height;
-                    tft.fillRect(0, 0, screen_width, y, RA8875_BLACK);
-
-                } else if (escParam1 == 2) {
-                    clear_screen();
-                }
-            }
-            // Esc[K = erase to end of line, Esc[1K = erase to start of line
-            else if (serInChar == 'K') {
-                tft.getCursor(currentX, currentY);
-                if (escParam1 == 0) {
-                    // clear to end of line
-                    int16_t x = currentX;
-                    int16_t y = currentY;
-                    int16_t w = screen_width - currentX;
-                    int16_t h = char_height;
-                    tft.fillRect(x, y, w, h, RA8875_BLACK);
-
-                } else if (escParam1 == 1) {
-                    // clear to start of line
-                    int16_t y = currentY;
-                    int16_t w = currentX;
-                    int16_t h = char_height;
-                    tft.fillRect(0, y, w, h, RA8875_BLACK);
-
-                } else if (escParam1 == 2) {
-                    // clear entire line
-                    int16_t y = currentY;
-                    int16_t w = screen_width;
-                    int16_t h = char_height;
-                    tft.fillRect(0, y, w, h, RA8875_BLACK);
-                }
+        //If it is an escape character then the following characters are
+        //interpreted as an ANSI escape sequence
+        parse_state = ESCAPE;
+
+    } else if (data == 0x0F) { // SI
+        shift_set = 0;
+
+    } else if (data == 0x0E) { // SO
+        shift_set = 1;
+
+    } else if (data > 31 && data < 127) {
+        if (graphics_set[shift_set] && data >= 0x5F) put_glyph(dec_graphics_glyph(data));
+        else put_run(&data, 1);
+
+    } else if ((data & 0xE0) == 0xC0) {
+        utf8_cp = data & 0x1F;
+        utf8_need = 1;
+    } else if ((data & 0xF0) == 0xE0) {
+        utf8_cp = data & 0x0F;
+        utf8_need = 2;
+    } else if ((data & 0xF8) == 0xF0) {
+        utf8_cp = data & 0x07;
+        utf8_need = 3;
+    } else if (data & 0x80) {
+        // a continuation byte on its own, or not valid in UTF-8
+        put_glyph(GLYPH_REPLACEMENT);
+    }
+}
 
-            }
-            // Esc[nT = scroll down. optional n is number of lines to scroll
-            else if (serInChar == 'T') {
-                if (escParam1 == 0) escParam1 = 1;
-                for (int i = 0; i < escParam1; ++i) {
-                    scroll_down();
-                }
-            }
-            // Esc[nS = scroll up. optional n is number of lines to scroll
-            else if (serInChar == 'S') {
-                if (escParam1 == 0) escParam1 = 1;
-                for (int i = 0; i < escParam1; ++i) {
-                    scroll_up();
-                }
-            }
-        } // end of in char = '['
+// length of the run of printable characters at the start of p, a word at
+// a time once p is aligned
+static size_t printable_len(const char *p, size_t len)
+{
+    const char *s = p, *end = p + len;
+    while(p < end && ((uintptr_t)p & 3) != 0) {
+        if(*p < 32 || *p > 126) return p - s;
+        ++p;
+    }
+    while(end - p >= 4) {
+        uint32_t w = *(const uint32_t *)p;
+        // any byte below 0x20, or above 0x7E (including 0x80 and up)
+        if(((w - 0x20202020UL) & ~w & 0x80808080UL) || ((w + 0x01010101UL) | w) & 0x80808080UL) break;
+        p += 4;
+    }
+    while(p < end && *p >= 32 && *p <= 126) ++p;
+    return p - s;
+}
 
-        // EscM scroll up
-        else if (serInChar == 'M') {
-            scroll_up();
-        }
-        // EscL scroll down
-        else if (serInChar == 'L') {
-            scroll_down();
-        }
-    } // end of in char = 27
-    else if (data > 31 && data < 128) {
-        // display character, scroll if hit end of screen
-        tft.getCursor(currentX, currentY);
-        if(currentX >= 0 && currentY >= screen_height) {
-            scroll_up();
+// process len characters, runs of printable characters are stored directly
+// rather than a character at a time
+void process_run(const char *buf, size_t len)
+{
+#ifdef USETOUCH
+    if(selection_shown) clear_selection();
+#endif
+    const char *end = buf + len;
+    while(buf < end) {
+        size_t n = parse_state == GROUND && utf8_need == 0 && !graphics_set[shift_set] ? printable_len(buf, end - buf) : 0;
+        if(n == 0) {
+            process(*buf++);
+            continue;
         }
-        tft.print(data);
+        put_run(buf, n);
+        buf += n;
     }
 }
 
+// show a key typed with local echo on. The parser state is put aside so
+// the key is not taken as part of a host escape or UTF-8 sequence that is
+// still arriving, only CR, LF, BS and printables are echoed so none of
+// them can start one.
+void echo_char(char data)
+{
+    parse_state_t state = parse_state;
+    uint8_t need = utf8_need;
+    parse_state = GROUND;
+    utf8_need = 0;
+    process(data);
+    parse_state = state;
+    utf8_need = need;
+}
+
 void doreset()
 {
 
@@ -645,18 +2491,81 @@ void doreset()
 // process VT100 escape sequences
 void loop()
 {
-    char data;
+    static uint32_t last_frame = 0;
+    static bool drawn = true;
+
+    // taking in host output always comes first so the UART never overflows
+    if(!buffer_input() && config_active) {
+        // host output is only buffered while the settings menu is up,
+        // if it is about to overflow close the menu and display it
+        config_close(false);
+    }
+
+    if(!config_active) {
+        // parse a slice of each session at a time so the UARTs get drained
+        // in between, and a port that never stops sending cannot hold up
+        // the other one
+#ifdef DEBUG
+        bool overlapped = bte_running;
+        uint32_t slice_start = micros();
+#endif
+        size_t total = 0;
+        for (uint8_t i = 0; i < SESSIONS; i++) {
+            RingBuffer<char, RX_BUFFER_SIZE>& rx = rx_buffers[i];
+            if(rx.empty()) continue;
+            switch_session(i);
+            size_t budget = PARSE_SLICE;
+            while(budget > 0 && !rx.empty()) {
+                size_t n;
+                const char *p = rx.front_span(n);
+                if(n > budget) n = budget;
+                process_run(p, n);
+                rx.consume(n);
+                budget -= n;
+            }
+            total += PARSE_SLICE - budget;
+        }
+        // the cursor is drawn where the session with the focus has it
+        switch_session(focus);
 #ifdef DEBUG
-    while (Serial.available()) {
-        data = Serial.read();
-        process(data);
+        // how much parsing happened while the RA8875 was busy scrolling,
+        // and the longest any slice took to parse
+        static uint32_t parsed = 0, parsed_overlapped = 0, worst_slice = 0, last_stats = 0;
+        uint32_t slice_us = micros() - slice_start;
+        if(slice_us > worst_slice) worst_slice = slice_us;
+        parsed += total;
+        if(overlapped) parsed_overlapped += total;
+        if(millis() - last_stats >= 10000) {
+            if(parsed > 0) Serial.printf("parsed %lu bytes, %lu during a scroll, slowest slice %lu us\n", parsed, parsed_overlapped, worst_slice);
+            Serial.printf("asleep %lu%%, slowest wake to drain %lu us\n", slept_us / ((millis() - last_stats) * 10), worst_wake);
+            parsed = parsed_overlapped = worst_slice = 0;
+            slept_us = worst_wake = 0;
+            last_stats = millis();
+        }
+#endif
+
+        // draw at most once a frame and only once everything received has
+        // been parsed, unless the host keeps the buffer from ever emptying.
+        // A frame that has not finished carries on straight away
+        uint32_t since = millis() - last_frame;
+        if(!drawn || (buffered() == 0 && since >= FRAME_MS) || since >= FRAME_MAX_MS) {
+            if(drawn) last_frame = millis();
+            drawn = render();
+        }
     }
+
+#ifdef FLIGHTREC
+    flightrec_poll();
 #endif
 
-    while (Serial1.available()) {
-        data = Serial1.read();
-        process(data);
+#ifdef USETOUCH
+    // touch reports are read here rather than in the interrupt handler
+    if(has_touch) {
+        gsl_poll();
+        if(!config_active) process_touch();
+        send_pending_keys();
     }
+#endif
 
 #ifdef KEYBOARD
     // get a key from the keyboard
@@ -664,12 +2573,16 @@ void loop()
 
     uint8_t mods = c >> 8; // modifier keys
     if(c != 0) {
+        activity();
         #ifdef DEBUG
         Serial.printf("Got key %04X\n", c);
         #endif
 
         c = c & 0xFF;
-        if((mods & 0x06) == 0x06 && c == 0x7F) {
+        if(config_active) {
+            config_key(c);
+
+        } else if((mods & 0x06) == 0x06 && c == 0x7F) {
             // we have ctrl-alt-del
             doreset();
         } else {
@@ -680,9 +2593,9 @@ void loop()
             else if(c == 0x84) ansic = 'C'; // right
             if(ansic != 0) {
                 // send ansi cursor sequence
-                Serial1.write(27); // ESC
-                Serial1.write('[');
-                Serial1.write(ansic);
+                port->write(27); // ESC
+                port->write('[');
+                port->write(ansic);
                 if(local_echo) {
                     move_cursor(ansic, 1);
                 }
@@ -692,48 +2605,73 @@ void loop()
 
             } else if(c == 0x85) { // today key goes into setup
                 config_setup();
+#ifdef SPLIT
+            } else if(c == 0x89) { // tasks key moves the keyboard to the other pane
+                if(split) {
+                    focus = (focus + 1) % SESSIONS;
+                    switch_session(focus);
+                }
+#endif
 
             } else {
-                Serial1.write(c);
+                port->write(c);
                 if(local_echo) {
-                    if(c == '\r' || c == '\n' || c == 8) process(c);
-                    else if(c < ' ' || c >= 0x80) tft.printf("\\x%02X", c);
-                    else if(c >= ' ') tft.printf("%c", c);
+                    if(c == '\r' || c == '\n' || c == 8 || (c >= ' ' && c < 0x80)) {
+                        echo_char(c);
+                    } else {
+                        char hex[5];
+                        snprintf(hex, sizeof(hex), "\\x%02X", c);
+                        for (char *p = hex; *p; ++p) echo_char(*p);
+                    }
                 }
             }
         }
     }
 #endif
 
+    // nothing left to do until the next interrupt
+    bool idle = buffered() == 0 && drawn;
+#ifdef USETOUCH
+    idle = idle && touch_events.empty() && keys_left == 0;
+#endif
+    if(idle) idle_wait();
+
 #ifdef TEST
+    static const char *poem[] = {
+        "Once upon a midnight dreary, while I pondered, weak and weary,",
+        "Over many a quaint and curious volume of forgotten lore,",
+        "While I nodded, nearly napping, suddenly there came a tapping,",
+        "As of some one gently rapping, rapping at my chamber door.",
+        "'Tis some visitor,' I muttered, 'tapping at my chamber door Only this, and nothing more.'",
+        "",
+        "Ah, distinctly I remember it was in the bleak December,",
+        "And each separate dying ember wrought its ghost upon the floor.",
+        "Eagerly I wished the morrow;- vainly I had sought to borrow",
+        "From my books surcease of sorrow- sorrow for the lost Lenore-",
+        "For the rare and radiant maiden whom the angels name Lenore-",
+        "Nameless here for evermore.",
+    };
     bool dir = false;
 
     while(true) {
         clear_screen();
-        tft.setCursor(0, 0);
-
-        tft.println("Once upon a midnight dreary, while I pondered, weak and weary,");
-        tft.println("Over many a quaint and curious volume of forgotten lore,");
-        tft.println("While I nodded, nearly napping, suddenly there came a tapping,");
-        tft.println("As of some one gently rapping, rapping at my chamber door.");
-        tft.println("'Tis some visitor,' I muttered, 'tapping at my chamber door Only this, and nothing more.'");
-        tft.println("");
-        tft.println("Ah, distinctly I remember it was in the bleak December,");
-        tft.println("And each separate dying ember wrought its ghost upon the floor.");
-        tft.println("Eagerly I wished the morrow;- vainly I had sought to borrow");
-        tft.println("From my books surcease of sorrow- sorrow for the lost Lenore-");
-        tft.println("For the rare and radiant maiden whom the angels name Lenore-");
-        tft.println("Nameless here for evermore.");
+        for (const char *line : poem) {
+            process_run(line, strlen(line));
+            process_run("\r\n", 2);
+        }
+        render_flush();
         delay(1000);
 
         if(dir) {
             for (int i = 0; i < 12; ++i) {
                 scroll_up();
+                render_flush();
                 delay(100);
             }
         } else {
             for (int i = 0; i < 12; ++i) {
                 scroll_down();
+                render_flush();
                 delay(1000);
             }
         }
@@ -4,18 +4,21 @@
 // system only: chip and sector erase, block write, sequential byte read.
 // Other than possibly adding support for other Winbond flash in the
 // future, the plan is to NOT bloat this out with all bells and whistles;
-// functions like block reads or buffered writes can be implemented in
-// client code where RAM can be better managed in the context of the
-// overall application (1 flash page = 1/2 the ATtiny85's RAM).
+// buffered writes can be implemented in client code where RAM can be
+// better managed in the context of the overall application (1 flash page =
+// 1/2 the ATtiny85's RAM).
+// Reads use the fast read command and bulk SPI transfers into a caller
+// supplied buffer, single byte reads are still available.
 // Written by Limor Fried and Phillip Burgess for Adafruit Industries.
 // MIT license.
 
-#ifdef USETOUCH
 #include "tinyflash.h"
+#ifdef USEFLASH
 
 #define MYSPI SPI1
 #define CMD_PAGEPROG     0x02
 #define CMD_READDATA     0x03
+#define CMD_FASTREAD     0x0B
 #define CMD_WRITEDISABLE 0x04
 #define CMD_READSTAT1    0x05
 #define CMD_WRITEENABLE  0x06
@@ -29,8 +32,11 @@
 // Currently rigged for W25Q80BV only
 #define CHIP_BYTES       1L * 1024L * 1024L
 
+// Fast read is good to 104MHz, so the limit is SPI1 on the Teensy LC which is F_BUS/2
+#define SPI_CLOCK        24000000
+
 #include <SPI.h>
-#define CHIP_SELECT   { MYSPI.beginTransaction(SPISettings(20000000, MSBFIRST, SPI_MODE0)); digitalWrite(cs_pin, LOW); }
+#define CHIP_SELECT   { MYSPI.beginTransaction(SPISettings(SPI_CLOCK, MSBFIRST, SPI_MODE0)); digitalWrite(cs_pin, LOW); }
 #define CHIP_DESELECT { digitalWrite(cs_pin, HIGH); MYSPI.endTransaction(); }
 #define spi_xfer(n)   MYSPI.transfer(n)
 
@@ -66,6 +72,16 @@ uint32_t TinyFlash::begin(void) {
 	return ((manID == 0xEF) && (devID == 0x13)) ? CHIP_BYTES : 0L;
 }
 
+// Check if an erase or program operation is still in progress
+boolean TinyFlash::isBusy(void) {
+	uint8_t status;
+
+	cmd(CMD_READSTAT1);
+	status = spi_xfer(0);
+	CHIP_DESELECT
+	return (status & STAT_BUSY) ? true : false;
+}
+
 // Poll status register until busy flag is clear or timeout occurs
 boolean TinyFlash::waitForReady(uint32_t timeout) {
 	uint8_t  status;
@@ -86,20 +102,35 @@ boolean TinyFlash::beginRead(uint32_t addr) {
 
 	if((addr >= CHIP_BYTES) || !waitForReady()) return false;
 
-	cmd(CMD_READDATA);
+	cmd(CMD_FASTREAD);
 	(void)spi_xfer(addr >> 16);
 	(void)spi_xfer(addr >>  8);
 	(void)spi_xfer(addr      );
+	(void)spi_xfer(0); // Fast read needs one dummy byte
 	// Chip is held in selected state until endRead()
 
 	return true;
 }
 
+// Read len bytes starting at addr into buf in one bulk transfer
+boolean TinyFlash::read(uint32_t addr, uint8_t *buf, uint32_t len) {
+	if((addr + len) > CHIP_BYTES || !beginRead(addr)) return false;
+	readNextBytes(buf, len);
+	endRead();
+	return true;
+}
+
 // Read next byte (call N times following beginRead())
 uint8_t TinyFlash::readNextByte(void) {
 	return spi_xfer(0);
 }
 
+// Read the next len bytes following beginRead() in one bulk transfer
+void TinyFlash::readNextBytes(uint8_t *buf, uint32_t len) {
+	memset(buf, 0, len);
+	MYSPI.transfer(buf, len);
+}
+
 // Stop read operation
 void TinyFlash::endRead(void) {
 	CHIP_DESELECT
@@ -122,8 +153,10 @@ boolean TinyFlash::eraseChip(void) {
 	return true;
 }
 
-// Erase one 4K sector
-boolean TinyFlash::eraseSector(uint32_t addr) {
+// Start erasing one 4K sector and return without waiting for it to
+// finish, poll isBusy() or waitForReady() before the next operation.
+// The chip clears write enable itself when the erase completes.
+boolean TinyFlash::startEraseSector(uint32_t addr) {
 
 	if(!waitForReady() || !writeEnable()) return false;
 
@@ -133,6 +166,14 @@ boolean TinyFlash::eraseSector(uint32_t addr) {
 	(void)spi_xfer(0         ); // lowest bits are ignored.
 	CHIP_DESELECT
 
+	return true;
+}
+
+// Erase one 4K sector
+boolean TinyFlash::eraseSector(uint32_t addr) {
+
+	if(!startEraseSector(addr)) return false;
+
 	if(!waitForReady(1000L)) return false; // Datasheet says 400ms max
 
 	writeDisable();
@@ -164,6 +205,19 @@ void TinyFlash::writeDisable(void) {
 // no other options.  This is the ONLY write method provided by the library;
 // other capabilities (if needed) may be implemented in client code.
 boolean TinyFlash::writePage(uint32_t addr, uint8_t *data) {
+	if(!startWritePage(addr, data)) return false;
+
+	delay(3);     // Max page program time according to datasheet
+
+	if(!waitForReady()) return false;
+
+	writeDisable();
+
+	return true;
+}
+// Send one page to be programmed and return without waiting for the
+// write to complete, same rules as writePage()
+boolean TinyFlash::startWritePage(uint32_t addr, uint8_t *data) {
 	if((addr >= CHIP_BYTES) || !waitForReady() || !writeEnable())
 		return false;
 
@@ -176,12 +230,6 @@ boolean TinyFlash::writePage(uint32_t addr, uint8_t *data) {
 	}
 	CHIP_DESELECT // Write occurs after the CS line is de-asserted
 
-	delay(3);     // Max page program time according to datasheet
-
-	if(!waitForReady()) return false;
-
-	writeDisable();
-
 	return true;
 }
 #endif
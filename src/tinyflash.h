@@ -3,6 +3,12 @@
 
 #include <Arduino.h>
 
+// the flash holds the touch firmware and the flight recorder log, and is
+// also needed to program it
+#if defined(USETOUCH) || defined(FLASHFW) || defined(VERIFYFW) || defined(FLIGHTREC)
+#define USEFLASH
+#endif
+
 class TinyFlash {
  public:
   TinyFlash(uint8_t cs = 6);
@@ -12,11 +18,16 @@ class TinyFlash {
                     writePage(uint32_t addr, uint8_t *data),
                     eraseChip(void),
                     eraseSector(uint32_t addr);
+  boolean           read(uint32_t addr, uint8_t *buf, uint32_t len);
   uint8_t           readNextByte(void);
+  void              readNextBytes(uint8_t *buf, uint32_t len);
   void              endRead(void);
+  boolean           startEraseSector(uint32_t addr),
+                    startWritePage(uint32_t addr, uint8_t *data),
+                    isBusy(void),
+                    waitForReady(uint32_t timeout = 100L);
  private:
-  boolean           waitForReady(uint32_t timeout = 100L),
-                    writeEnable(void);
+  boolean           writeEnable(void);
   void              writeDisable(void),
                     cmd(uint8_t c);
   uint8_t           cs_pin;
@@ -0,0 +1,118 @@
+// Touch panel calibration and filtering
+// All integer fixed point as the Cortex-M0+ has no FPU.
+//
+// Calibration is an affine transform from raw touch coordinates to landscape
+// display pixels, solved from three touched targets:
+//   x' = (A*x + B*y + C) >> CAL_SHIFT
+//   y' = (D*x + E*y + F) >> CAL_SHIFT
+// Only the three raw points are stored with the settings, the coefficients
+// are recomputed at boot.
+//
+// Jitter is filtered with a median of the last three samples followed by
+// a 1/4 IIR, both per axis.
+
+#ifdef USETOUCH
+#include <Arduino.h>
+
+#define CAL_SHIFT 14            // coefficients are Q14, raw is 12 bits so A*x fits in 26 bits
+#define IIR_SHIFT 2             // new = old + (sample - old) / 4
+#define IIR_FRAC 4              // fractional bits kept in the IIR state
+
+struct cal_point_t { uint16_t x, y; };
+
+// the targets in landscape display pixels, well in from the edges
+extern const cal_point_t cal_targets[3];
+const cal_point_t cal_targets[3] = { {80, 48}, {720, 240}, {400, 432} };
+
+static int32_t cal_a = 1 << CAL_SHIFT, cal_b = 0, cal_c = 0;
+static int32_t cal_d = 0, cal_e = 1 << CAL_SHIFT, cal_f = 0;
+
+static struct {
+    int16_t hist_x[3], hist_y[3];
+    int32_t iir_x, iir_y;
+    uint8_t n;
+} filter;
+
+// solve the affine transform for the raw points touched on cal_targets
+// returns false if the points are degenerate (in a line)
+bool touch_cal_compute(const cal_point_t raw[3])
+{
+    int32_t x0 = raw[0].x, x1 = raw[1].x, x2 = raw[2].x;
+    int32_t y0 = raw[0].y, y1 = raw[1].y, y2 = raw[2].y;
+    int32_t det = (x0 - x2) * (y1 - y2) - (x1 - x2) * (y0 - y2);
+    if(det == 0) return false;
+
+    // 64 bit intermediates, this only runs at boot and after calibration
+    int64_t X0 = cal_targets[0].x, X1 = cal_targets[1].x, X2 = cal_targets[2].x;
+    int64_t Y0 = cal_targets[0].y, Y1 = cal_targets[1].y, Y2 = cal_targets[2].y;
+    int32_t a = (((X0 - X2) * (y1 - y2) - (X1 - X2) * (y0 - y2)) * (1 << CAL_SHIFT)) / det;
+    int32_t b = (((x0 - x2) * (X1 - X2) - (X0 - X2) * (x1 - x2)) * (1 << CAL_SHIFT)) / det;
+    int32_t d = (((Y0 - Y2) * (y1 - y2) - (Y1 - Y2) * (y0 - y2)) * (1 << CAL_SHIFT)) / det;
+    int32_t e = (((x0 - x2) * (Y1 - Y2) - (Y0 - Y2) * (x1 - x2)) * (1 << CAL_SHIFT)) / det;
+
+    // keep the scale sane so the Q14 products can not overflow
+    const int32_t lim = 4 << CAL_SHIFT;
+    if(abs(a) > lim || abs(b) > lim || abs(d) > lim || abs(e) > lim) return false;
+
+    cal_a = a; cal_b = b; cal_d = d; cal_e = e;
+    cal_c = (X0 << CAL_SHIFT) - a * x0 - b * y0;
+    cal_f = (Y0 << CAL_SHIFT) - d * x0 - e * y0;
+    return true;
+}
+
+// call when a finger goes down so the filter does not smear from the last touch
+void touch_filter_reset()
+{
+    filter.n = 0;
+}
+
+static inline int16_t median3(int16_t a, int16_t b, int16_t c)
+{
+    if(a > b) { int16_t t = a; a = b; b = t; }
+    if(b > c) b = c;
+    return a > b ? a : b;
+}
+
+// filter a raw sample then map it to landscape display pixels
+void touch_transform(uint16_t rx, uint16_t ry, int16_t& x, int16_t& y)
+{
+    int16_t *hx = filter.hist_x, *hy = filter.hist_y;
+    if(filter.n == 0) {
+        // prime the history and IIR with the first sample
+        hx[0] = hx[1] = hx[2] = rx;
+        hy[0] = hy[1] = hy[2] = ry;
+        filter.iir_x = (int32_t)rx << IIR_FRAC;
+        filter.iir_y = (int32_t)ry << IIR_FRAC;
+        filter.n = 1;
+    } else {
+        hx[0] = hx[1]; hx[1] = hx[2]; hx[2] = rx;
+        hy[0] = hy[1]; hy[1] = hy[2]; hy[2] = ry;
+        int32_t mx = median3(hx[0], hx[1], hx[2]) << IIR_FRAC;
+        int32_t my = median3(hy[0], hy[1], hy[2]) << IIR_FRAC;
+        filter.iir_x += (mx - filter.iir_x) >> IIR_SHIFT;
+        filter.iir_y += (my - filter.iir_y) >> IIR_SHIFT;
+    }
+
+    int32_t fx = filter.iir_x >> IIR_FRAC;
+    int32_t fy = filter.iir_y >> IIR_FRAC;
+    x = (cal_a * fx + cal_b * fy + cal_c) >> CAL_SHIFT;
+    y = (cal_d * fx + cal_e * fy + cal_f) >> CAL_SHIFT;
+}
+
+#ifdef DEBUG
+// time the filter and transform, the Teensy LC has no cycle counter so use micros()
+void touch_benchmark()
+{
+    const int n = 1000;
+    int16_t x, y;
+    touch_filter_reset();
+    uint32_t start = micros();
+    for (int i = 0; i < n; i++) {
+        touch_transform(400 + (i & 7), 240 - (i & 3), x, y);
+    }
+    uint32_t us = micros() - start;
+    touch_filter_reset();
+    Serial.printf("touch pipeline: %lu cycles/sample\n", (us * (F_CPU / 1000000)) / n);
+}
+#endif
+#endif
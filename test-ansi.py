@@ -1,6 +1,7 @@
 #!/usr/bin/python3
 
-# Tests ansi sequences
+# Tests ansi sequences on the device, test/test_cells.cpp checks the text
+# they leave on the screen with a host build of the terminal core
 import serial
 import time
 
@@ -27,10 +28,10 @@ ser.write(b"From my books surcease of sorrow- sorrow for the lost Lenore-\r\n")
 ser.write(b"For the rare and radiant maiden whom the angels name Lenore-\r\n")
 ser.write(b"Nameless here for evermore.\r\n")
 
-ser.write(b"\x1B[0;14H")
+ser.write(b"\x1B[14;0H")
 ser.write(b"this is line 14\r\n")
 
-ser.write(b"\x1B[20;15H")
+ser.write(b"\x1B[15;20H")
 ser.write(b"col 20\r\n")
 
 time.sleep(2)
@@ -43,29 +44,29 @@ ser.write(b"\x1B[4S")
 time.sleep(2)
 
 # clear line to right
-ser.write(b"\x1B[20;5H")
+ser.write(b"\x1B[5;20H")
 ser.write(b"\x1B[K")
 
 # clear line to left
-ser.write(b"\x1B[20;3H")
+ser.write(b"\x1B[3;20H")
 ser.write(b"\x1B[1K")
 
 time.sleep(2)
 
 # clear to end of screen
-ser.write(b"\x1B[5;8H")
+ser.write(b"\x1B[8;5H")
 ser.write(b"\x1B[J")
 
 time.sleep(2)
 # clear to top of screen
-ser.write(b"\x1B[6;7H")
+ser.write(b"\x1B[7;6H")
 ser.write(b"\x1B[1J")
 
 # clear screen and set to top
 ser.write(b"\x1B[2J")
 ser.write(b"\x1B[0;0H")
 
-ser.write(b"\x1B[25;0H")
+ser.write(b"\x1B[0;25H")
 for x in range(49, 59):
     b = bytearray([x, 10, 8])
     ser.write(b)
@@ -91,4 +92,40 @@ ser.write(b"11th column")
 ser.write(b"\x1B[21D")
 ser.write(b"1")
 
+time.sleep(2)
+
+# autowrap, the X fills the last column and the wrap waits for the next character
+ser.write(b"\x1B[2J")
+ser.write(b"\x1B[3;1H")
+ser.write(b"\x1B[99C")
+ser.write(b"X")
+ser.write(b"wrapped to line 4")
+
+# a CR after the last column drops the pending wrap, so the text is on line 6,
+# or on line 7 (not 8) with CR converted to CRLF as it is by default
+ser.write(b"\x1B[6;1H")
+ser.write(b"\x1B[99CX\rafter the CR")
+
+# no autowrap, the line ends in a Z and nothing goes to line 9
+ser.write(b"\x1B[?7l")
+ser.write(b"\x1B[8;1H")
+ser.write(b"-" * 120 + b"Z")
+ser.write(b"\x1B[?7h")
+ser.write(b"\x1B[10;1H")
+
+time.sleep(2)
+
+# UTF-8, box drawing, blocks, Latin-1 and a replacement for what has no glyph
+ser.write(b"\x1B[2J")
+ser.write(b"\x1B[1;1H")
+ser.write("┌──┬──┐ ╔══╦══╗\r\n".encode())
+ser.write("│ab│cd│ ║ef║gh║\r\n".encode())
+ser.write("└──┴──┘ ╚══╩══╝\r\n".encode())
+ser.write("░▒▓█▀▄▌▐ café naïve £5 ±1 °C\r\n".encode())
+ser.write("日本 ".encode() + b"\xff\r\n")
+
+time.sleep(2)
 
+# DEC special graphics as curses uses it, the same box twice
+ser.write(b"\x1B(0lqqqqwqqqqk\r\nx    x    x\r\nmqqqqvqqqqj\x1B(B\r\n")
+ser.write(b"\x1B)0\x0Elqqqqwqqqqk\r\nx    x    x\r\nmqqqqvqqqqj\x0F\r\n")
@@ -0,0 +1,69 @@
+// Runs the fuzz target without libFuzzer: on each file given, or else on
+// generated input that is mostly escape sequences, so that a compiler
+// without libFuzzer still gives the parser a shake with every make.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#define RUNS 2000
+#define MAX_LEN 4096
+
+// pieces host output is made of, with the numbers and finals the parser
+// cares about more likely than any byte
+static const char *const pieces[] = {
+    "\x1B[", "\x1B[?", "\x1B(0", "\x1B)0", "\x1B(B", "\x0E", "\x0F", "\x1B", "\x1B" "7", "\x1B" "8",
+    "\x1BM", "\x1BL", "\r", "\n", "\b", ";", "0", "1", "2", "18", "99", "999", "9999", "65535",
+    "A", "B", "C", "D", "E", "F", "G", "H", "f", "J", "K", "S", "T", "s", "u", "t", "h", "l",
+    "1049", "1047", "47", "7", "1000", "1002", "1006", "m",
+    "Once upon a midnight dreary", "\xE2\x94\x80", "\xC3\xA9", "\xE6\x97\xA5", "\xF0\x9F\x98\x80", "\xFF", "\x80",
+};
+#define NPIECES (sizeof(pieces) / sizeof(pieces[0]))
+
+static uint32_t rng = 1;
+
+static uint32_t next()
+{
+    rng = rng * 1103515245 + 12345;
+    return rng >> 8;
+}
+
+static void run_file(const char *fn)
+{
+    FILE *f = fopen(fn, "rb");
+    if(!f) {
+        perror(fn);
+        exit(1);
+    }
+    std::vector<uint8_t> data;
+    int c;
+    while((c = fgetc(f)) != EOF) data.push_back(c);
+    fclose(f);
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) run_file(argv[i]);
+    if(argc > 1) return 0;
+
+    std::vector<uint8_t> data;
+    for (int run = 0; run < RUNS; run++) {
+        data.clear();
+        data.push_back(next());
+        size_t len = next() % MAX_LEN;
+        while(data.size() < len) {
+            if(next() % 8 == 0) {
+                data.push_back(next());
+            } else {
+                for (const char *p = pieces[next() % NPIECES]; *p; p++) data.push_back(*p);
+            }
+        }
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    printf("fuzz_parser: %d runs ok\n", RUNS);
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Fuzz target for the parser and the cell core: process_run() and all it
+// reaches (csi_dispatch, scroll_cells, erase_cells, the alternate screen
+// and the rest). After each run of input the cursor must be on the screen,
+// and no run may cost more than a bounded amount of work for each byte.
+//
+// With clang this is a libFuzzer target:
+//   make -C test fuzz CXX=clang++ && test/fuzz_parser
+// Otherwise fuzz_main.cpp drives it with generated input, as part of make.
+//
+// The first byte of the input picks the settings and the screen geometry,
+// the rest is host output, fed in runs of 1 to 64 bytes.
+
+#include <Arduino.h>
+#include <RA8875.h>
+#include <assert.h>
+#include <chrono>
+#include "config.h"
+
+extern RA8875 tft;
+extern uint16_t grid_cols, grid_rows;
+extern uint16_t screen_cols, screen_rows;
+extern uint16_t cursor_col, cursor_row;
+extern bool lfcrlf, crcrlf;
+void set_geometry();
+void process_run(const char *buf, size_t len);
+
+// Work allowed for each byte. The most a byte can do is a scroll or erase
+// of the whole screen, or drawing all of it when the alternate screen is
+// entered, so a byte may take at most a few screens' worth of display
+// calls. The time limit leaves room for the sanitizers, it catches a
+// byte that loops over a count rather than the screen.
+#define MAX_DRAWS_PER_BYTE (4 * MAX_CELLS)
+#define MAX_SENT_PER_BYTE 16
+#define MAX_US_PER_BYTE 2000
+
+// whatever state the last input left the parser in, "m" ends it and the
+// rest puts the modes back to their defaults
+static const char reset_seq[] = "m\x1B(B\x1B)B\x0F\x1B[?7h\x1B[?1049l\x1B[?1000l\x1B[?1006l\x1B[2J\x1B[H";
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if(size == 0) return 0;
+    uint8_t cfg = *data++;
+    size--;
+
+    // as setup() does before anything is parsed
+    static bool started = false;
+    if(!started) set_geometry();
+    started = true;
+
+    process_run(reset_seq, sizeof(reset_seq) - 1);
+    lfcrlf = cfg & 1;
+    crcrlf = cfg & 2;
+    tft.setRotation(cfg >> 2);
+    tft.setFontScale(cfg >> 4);
+    set_geometry();
+    assert(grid_cols * grid_rows <= MAX_CELLS && grid_rows <= MAX_ROWS);
+
+    uint32_t seed = cfg;
+    while(size > 0) {
+        seed = seed * 1103515245 + 12345;
+        size_t n = 1 + (seed >> 16) % 64;
+        if(n > size) n = size;
+
+        uint32_t draws = tft_draws;
+        Serial1.sent.clear();
+        auto start = std::chrono::steady_clock::now();
+        process_run((const char *)data, n);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        assert(cursor_col < screen_cols && cursor_row < screen_rows);
+        assert(tft_draws - draws <= n * MAX_DRAWS_PER_BYTE);
+        assert(Serial1.sent.size() <= n * MAX_SENT_PER_BYTE);
+        assert(us <= (long)(n * MAX_US_PER_BYTE));
+
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
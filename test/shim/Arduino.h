@@ -0,0 +1,90 @@
+// Just enough of the Teensy core to build parts of the firmware on the host
+// for the tests in this directory. Output to the serial ports is kept in
+// sent for the tests to look at, nothing is ever received.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string>
+
+#define F_CPU 48000000
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define FALLING 2
+#define DEC 10
+#define SERIAL_8N1 0
+
+typedef bool boolean;
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+static inline void delayMicroseconds(uint32_t) {}
+static inline void pinMode(uint8_t, uint8_t) {}
+static inline void digitalWrite(uint8_t, uint8_t) {}
+static inline int digitalRead(uint8_t) { return HIGH; }
+static inline void attachInterrupt(uint8_t, void (*)(), int) {}
+static inline int digitalPinToInterrupt(int pin) { return pin; }
+static inline void __disable_irq() {}
+static inline void __enable_irq() {}
+static inline void yield() {}
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) { return write(&c, 1); }
+    virtual size_t write(const uint8_t *buf, size_t len) { return len; }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    virtual int availableForWrite() { return 0; }
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long n, int base = DEC) { return printf(base == 16 ? "%lX" : "%ld", n); }
+    size_t println(const char *s = "") { return print(s) + print("\r\n"); }
+    size_t println(long n, int base = DEC) { return print(n, base) + print("\r\n"); }
+    int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buf[256];
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        return write((const uint8_t *)buf, strlen(buf)) ? n : 0;
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    size_t readBytes(char *buf, size_t len) { return 0; }
+    void setTimeout(unsigned long) {}
+    void flush() {}
+};
+
+class HardwareSerial : public Stream {
+public:
+    std::string sent;
+    int tx_room = 64;   // what availableForWrite() reports
+    size_t write(const uint8_t *buf, size_t len) override { sent.append((const char *)buf, len); return len; }
+    int availableForWrite() override { return tx_room; }
+    void begin(uint32_t, int = 0) {}
+    void end() {}
+    void setRX(uint8_t) {}
+    void setTX(uint8_t) {}
+    uint8_t dtr() { return 0; }
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial, Serial1, Serial2, Serial3;
+
+template<class T> T min(T a, T b) { return a < b ? a : b; }
+template<class T> T max(T a, T b) { return a > b ? a : b; }
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
@@ -0,0 +1,14 @@
+// EEPROM as the erased part, so the settings are the defaults
+
+#pragma once
+
+#include <Arduino.h>
+
+class EEPROMClass {
+public:
+    uint8_t read(int) { return 0xFF; }
+    void update(int, uint8_t) {}
+    template<class T> T& get(int, T& t) { memset(&t, 0xFF, sizeof(t)); return t; }
+};
+
+extern EEPROMClass EEPROM;
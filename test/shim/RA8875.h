@@ -0,0 +1,129 @@
+// The RA8875 calls the firmware makes, as a display that draws nothing.
+// It has the size and font of the real one so the screen geometry is the
+// same, and a BTE move is always finished. Drawing calls are counted in
+// tft_draws.
+//
+// What would be on the screen is kept in shown, a character per cell of
+// the current font: font ROM text, user characters as 0x80 and up, black
+// fills and the BTE moves that scroll. Anything else drawn leaves it as
+// it was, and both layers are the one screen.
+
+#pragma once
+
+#include <Arduino.h>
+
+#define RA8875_BLACK 0x0000
+#define RA8875_WHITE 0xFFFF
+#define RA8875_GREEN 0x07E0
+#define RA8875_RED 0xF800
+#define RA8875_BLUE 0x001F
+#define RA8875_YELLOW 0xFFE0
+#define RA8875_CYAN 0x07FF
+#define RA8875_MAGENTA 0xF81F
+#define RA8875_BTEROP_SOURCE 0xC0
+#define BTEROP_NOT_DEST 0x50
+
+extern uint32_t tft_draws;
+
+enum RA8875sizes { RA8875_480x272, RA8875_800x480 };
+enum RA8875tcursor { NOCURSOR, IBEAM, UNDER, BLOCK };
+enum RA8875writes { L1, L2, CGRAM, PATTERN, CURSOR };
+enum RA8875boolean { LAYER1, LAYER2, TRANSPARENT, LIGHTEN, OR, AND, FLOATING };
+enum RA8875fontCoding { ISO_IEC_8859_1, ISO_IEC_8859_2, ISO_IEC_8859_3, ISO_IEC_8859_4 };
+
+#define SHOWN_ROWS 50
+#define SHOWN_COLS 100
+
+class RA8875 : public Print {
+    uint8_t rotation = 0, scale = 0;
+    int16_t cursor_x = 0, cursor_y = 0;
+
+    // the cell at pixel x, y, or null if off the screen
+    char *cell(int16_t x, int16_t y)
+    {
+        int16_t c = x / getFontWidth(), r = y / getFontHeight();
+        if(x < 0 || y < 0 || c >= SHOWN_COLS || r >= SHOWN_ROWS) return nullptr;
+        return &shown[r][c];
+    }
+
+    void fill(int16_t x, int16_t y, int16_t w, int16_t h, char ch)
+    {
+        for (int16_t py = y; py < y + h; py += getFontHeight()) {
+            for (int16_t px = x; px < x + w; px += getFontWidth()) {
+                if(char *p = cell(px, py)) *p = ch;
+            }
+        }
+    }
+
+public:
+    char shown[SHOWN_ROWS][SHOWN_COLS];
+
+    RA8875(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t) { memset(shown, ' ', sizeof(shown)); }
+    void begin(RA8875sizes) {}
+    void setRotation(uint8_t r) { rotation = r & 3; }
+    uint8_t getRotation() { return rotation; }
+    void setFontScale(uint8_t s) { scale = s & 3; }
+    uint8_t getFontWidth() { return 8 * (scale + 1); }
+    uint8_t getFontHeight() { return 16 * (scale + 1); }
+    int16_t width() { return rotation & 1 ? 480 : 800; }
+    int16_t height() { return rotation & 1 ? 800 : 480; }
+    size_t write(const uint8_t *buf, size_t len) override
+    {
+        tft_draws++;
+        for (size_t i = 0; i < len; i++, cursor_x += getFontWidth()) {
+            if(char *p = cell(cursor_x, cursor_y)) *p = buf[i];
+        }
+        return len;
+    }
+    void setCursor(int16_t x, int16_t y) { cursor_x = x; cursor_y = y; }
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+    {
+        tft_draws++;
+        // only whole cells of black, a line glyph is left out of shown
+        if(color == RA8875_BLACK) fill(x, y, w, h, ' ');
+    }
+    void drawRect(int16_t, int16_t, int16_t, int16_t, uint16_t) { tft_draws++; }
+    void fillWindow(uint16_t) { tft_draws++; memset(shown, ' ', sizeof(shown)); }
+    void drawFastHLine(int16_t, int16_t, int16_t, uint16_t) { tft_draws++; }
+    void drawFastVLine(int16_t, int16_t, int16_t, uint16_t) { tft_draws++; }
+    void drawCircle(int16_t, int16_t, int16_t, uint16_t) { tft_draws++; }
+    // a move backwards is given by its bottom right corners
+    void BTE_move(int16_t sx, int16_t sy, int16_t w, int16_t h, int16_t dx, int16_t dy, uint8_t = 0, uint8_t = 0, bool = false,
+        uint8_t rop = RA8875_BTEROP_SOURCE, bool = false, bool backward = false)
+    {
+        tft_draws++;
+        if(rop != RA8875_BTEROP_SOURCE) return;
+        if(backward) {
+            sx -= w - 1;
+            sy -= h - 1;
+            dx -= w - 1;
+            dy -= h - 1;
+        }
+        char from[SHOWN_ROWS][SHOWN_COLS];
+        memcpy(from, shown, sizeof(shown));
+        for (int16_t y = 0; y < h; y += getFontHeight()) {
+            for (int16_t x = 0; x < w; x += getFontWidth()) {
+                char *s = cell(sx + x, sy + y), *d = cell(dx + x, dy + y);
+                if(s && d) *d = (&from[0][0])[s - &shown[0][0]];
+            }
+        }
+    }
+    uint8_t readStatus() { return 0; }
+    void showCursor(RA8875tcursor, bool) {}
+    void setTextColor(uint16_t) {}
+    void setTextColor(uint16_t, uint16_t) {}
+    void sleep(bool) {}
+    void displayOn(bool) {}
+    void brightness(uint8_t) {}
+    void useLayers(bool) {}
+    void writeTo(RA8875writes) {}
+    void layerEffect(RA8875boolean) {}
+    void uploadUserChar(const uint8_t[], uint8_t) {}
+    void showUserChar(uint8_t n, uint8_t = 0)
+    {
+        tft_draws++;
+        if(char *p = cell(cursor_x, cursor_y)) *p = 0x80 + n;
+        cursor_x += getFontWidth();
+    }
+    void setIntFontCoding(RA8875fontCoding) {}
+};
@@ -0,0 +1,29 @@
+// SPI as a bus with nothing on it, reads are all ones
+
+#pragma once
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+#define SPI_CLOCK_DIV2 0
+
+class SPISettings {
+public:
+    SPISettings() {}
+    SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass {
+public:
+    void begin() {}
+    void beginTransaction(SPISettings) {}
+    void endTransaction() {}
+    void setClockDivider(uint8_t) {}
+    uint8_t transfer(uint8_t) { return 0xFF; }
+    void setMOSI(uint8_t) {}
+    void setMISO(uint8_t) {}
+    void setSCK(uint8_t) {}
+};
+
+extern SPIClass SPI, SPI1;
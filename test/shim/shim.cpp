@@ -0,0 +1,28 @@
+// The objects and the clock the Teensy core would provide
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <EEPROM.h>
+
+HardwareSerial Serial, Serial1, Serial2, Serial3;
+SPIClass SPI, SPI1;
+EEPROMClass EEPROM;
+uint32_t tft_draws = 0;
+
+// time stands still unless a test moves it on
+uint32_t now_us = 0;
+
+uint32_t millis()
+{
+    return now_us / 1000;
+}
+
+uint32_t micros()
+{
+    return now_us;
+}
+
+void delay(uint32_t ms)
+{
+    now_us += ms * 1000;
+}
@@ -0,0 +1,432 @@
+// Golden screen test of the terminal core: the sequences test-ansi.py sends
+// to the device are parsed on the host and the cells compared with the
+// screen they should leave. The display is the one in shim/RA8875.h, which
+// keeps the text it would show rather than the pixels. Built with -DSPLIT
+// as test_cells_split it also checks the split screen panes.
+//
+// The settings are those of a host that sends CRLF, with LF and CR not
+// converted, except where the conversion itself is being checked.
+
+#include <Arduino.h>
+#include <RA8875.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include "glyphs.h"
+#include "config.h"
+
+extern RA8875 tft;
+extern char screen_cells[];
+extern uint16_t grid_cols, grid_rows;
+extern uint16_t screen_cols, screen_rows;
+extern uint16_t cursor_col, cursor_row;
+extern bool lfcrlf, crcrlf;
+extern uint8_t split;
+#define LOST_CELL 0x7F  // as in terminal.cpp
+void set_geometry();
+void process_run(const char *buf, size_t len);
+void echo_char(char data);
+void reflow_screen();
+void render_flush();
+void switch_session(uint8_t i);
+
+static void send(const std::string& s)
+{
+    process_run(s.data(), s.size());
+}
+
+static std::string row_text(uint16_t r)
+{
+    std::string s(&screen_cells[r * grid_cols], grid_cols);
+    s.erase(s.find_last_not_of(' ') + 1);
+    return s;
+}
+
+static std::string sp(int n)
+{
+    return std::string(n, ' ');
+}
+
+static std::string glyphs(std::initializer_list<uint8_t> g)
+{
+    return std::string(g.begin(), g.end());
+}
+
+// the screen is rows, without trailing blanks, and then nothing but blanks
+static void expect_screen(const char *what, const std::vector<std::string>& rows)
+{
+    bool ok = true;
+    for (uint16_t r = 0; r < grid_rows; r++) {
+        std::string want = r < rows.size() ? rows[r] : "";
+        std::string got = row_text(r);
+        if(got == want) continue;
+        printf("%s: row %u\n  want \"%s\"\n  got  \"%s\"\n", what, r + 1, want.c_str(), got.c_str());
+        ok = false;
+    }
+    assert(ok);
+}
+
+// once it is all drawn the display shows what the cells hold, other than
+// the line glyphs the shim does not keep
+static void expect_shown(const char *what)
+{
+    render_flush();
+    bool ok = true;
+    for (uint16_t r = 0; r < grid_rows; r++) {
+        for (uint16_t c = 0; c < grid_cols; c++) {
+            char want = screen_cells[r * grid_cols + c], got = tft.shown[r][c];
+            if(got == want || (uint8_t)want == GLYPH_HLINE) continue;
+            printf("%s: row %u col %u shows '%c' not '%c'\n", what, r + 1, c + 1, got, want);
+            ok = false;
+        }
+    }
+    assert(ok);
+}
+
+static void reset()
+{
+    lfcrlf = crcrlf = false;
+    send("\x1B[2J\x1B[H");
+}
+
+static const char *poem[] = {
+    "Once upon a midnight dreary, while I pondered, weak and weary,",
+    "Over many a quaint and curious volume of forgotten lore,",
+    "While I nodded, nearly napping, suddenly there came a tapping,",
+    "As of some one gently rapping, rapping at my chamber door.",
+    "'Tis some visitor,' I muttered, 'tapping at my chamber door Only this, and nothing more.'",
+    "",
+    "Ah, distinctly I remember it was in the bleak December,",
+    "And each separate dying ember wrought its ghost upon the floor.",
+    "Eagerly I wished the morrow;- vainly I had sought to borrow",
+    "From my books surcease of sorrow- sorrow for the lost Lenore-",
+    "For the rare and radiant maiden whom the angels name Lenore-",
+    "Nameless here for evermore.",
+};
+
+// text, cursor addressing, scrolls and the erases
+static void test_text_and_erase()
+{
+    reset();
+    for (const char *line : poem) send(std::string(line) + "\r\n");
+    send("\x1B[14;0Hthis is line 14\r\n");
+    send("\x1B[15;20Hcol 20\r\n");
+
+    // down then up again leaves it as it was, the rows scrolled off were blank
+    send("\x1B[4T\x1B[4S");
+    std::vector<std::string> screen(poem, poem + 12);
+    screen.push_back("");
+    screen.push_back("this is line 14");
+    screen.push_back(sp(19) + "col 20");
+    expect_screen("scroll", screen);
+
+    send("\x1B[5;20H\x1B[K");
+    send("\x1B[3;20H\x1B[1K");
+    screen[4] = "'Tis some visitor,'";
+    screen[2] = sp(20) + "ly napping, suddenly there came a tapping,";
+    expect_screen("erase in line", screen);
+
+    send("\x1B[8;5H\x1B[J");
+    send("\x1B[7;6H\x1B[1J");
+    expect_screen("erase in display", { "", "", "", "", "", "",
+        "      stinctly I remember it was in the bleak December,", "And" });
+}
+
+// relative cursor movement, a column of digits written with LF and BS
+static void test_cursor_moves()
+{
+    reset();
+    send("\x1B[0;25H");
+    for (char c = '1'; c <= ':'; c++) send(std::string(1, c) + "\n\b");
+    send("\x1B[0;0H");
+    send("\x1B[3B4th line\r\n");
+    send("\x1B[4A1st line");
+    send("\x1B[5B\r12345678901234567890\r\n");
+    send("\x1B[10C11th column");
+    send("\x1B[21D1");
+
+    expect_screen("cursor moves", {
+        "1st line" + sp(16) + "1",
+        sp(24) + "2",
+        sp(24) + "3",
+        "4th line" + sp(16) + "4",
+        sp(24) + "5",
+        "12345678901234567890" + sp(4) + "6",
+        "1" + sp(9) + "11th column" + sp(3) + "7",
+        sp(24) + "8",
+        sp(24) + "9",
+        sp(24) + ":",
+    });
+}
+
+// the wrap after the last column waits for the next character, CR drops
+// it, and without autowrap the last column is overwritten
+static void test_autowrap()
+{
+    reset();
+    send("\x1B[3;1H\x1B[99CX");
+    assert(cursor_row == 2 && cursor_col == grid_cols - 1);
+    send("wrapped to line 4");
+    send("\x1B[6;1H\x1B[99CX\rafter the CR");
+    send("\x1B[?7l\x1B[8;1H" + std::string(120, '-') + "Z\x1B[?7h");
+    send("\x1B[10;1H");
+
+    expect_screen("autowrap", {
+        "", "",
+        sp(99) + "X",
+        "wrapped to line 4",
+        "",
+        "after the CR" + sp(87) + "X",
+        "",
+        std::string(99, '-') + "Z",
+    });
+
+    // with CR converted to CRLF, the default, the CR moves on one line and
+    // the pending wrap does not add another
+    crcrlf = true;
+    send("\x1B[2J\x1B[6;1H\x1B[99CX\rline 7");
+    expect_screen("autowrap with CR to CRLF", { "", "", "", "", "", sp(99) + "X", "line 7" });
+}
+
+// UTF-8 into box drawing, block and Latin-1 glyphs, then DEC special
+// graphics through G0 and through G1 with SO
+static void test_glyphs()
+{
+    const uint8_t H = GLYPH_HLINE, V = GLYPH_VLINE, R = GLYPH_REPLACEMENT;
+    const uint8_t TL = 0x82, TR = 0x83, BL = 0x84, BR = 0x85, TT = 0x88, BT = 0x89;
+    const uint8_t DH = GLYPH_DOUBLE_HLINE, DV = 0x8C, DTL = 0x8D, DTR = 0x8E, DBL = 0x8F, DBR = 0x90, DTT = 0x93, DBT = 0x94;
+
+    reset();
+    send("┌──┬──┐ ╔══╦══╗\r\n");
+    send("│ab│cd│ ║ef║gh║\r\n");
+    send("└──┴──┘ ╚══╩══╝\r\n");
+    send("░▒▓█▀▄▌▐ café naïve £5 ±1 °C\r\n");
+    send("日本 \xff\r\n");
+    send("\x1B(0lqqqqwqqqqk\r\nx    x    x\r\nmqqqqvqqqqj\x1B(B\r\n");
+    send("\x1B)0\x0Elqqqqwqqqqk\r\nx    x    x\r\nmqqqqvqqqqj\x0F\r\n");
+
+    std::string top = glyphs({ TL, H, H, H, H, TT, H, H, H, H, TR });
+    std::string mid = glyphs({ V }) + sp(4) + glyphs({ V }) + sp(4) + glyphs({ V });
+    std::string bottom = glyphs({ BL, H, H, H, H, BT, H, H, H, H, BR });
+    expect_screen("glyphs", {
+        glyphs({ TL, H, H, TT, H, H, TR, ' ', DTL, DH, DH, DTT, DH, DH, DTR }),
+        glyphs({ V }) + "ab" + glyphs({ V }) + "cd" + glyphs({ V }) + " " + glyphs({ DV }) + "ef" + glyphs({ DV }) + "gh" + glyphs({ DV }),
+        glyphs({ BL, H, H, BT, H, H, BR, ' ', DBL, DH, DH, DBT, DH, DH, DBR }),
+        glyphs({ 0x9B, 0x9C, 0x9D, 0x96, 0x97, 0x98, 0x99, 0x9A }) + " caf\xE9 na\xEFve \xA3" "5 \xB1" "1 \xB0" "C",
+        glyphs({ R, R, ' ', R }),
+        top, mid, bottom,
+        top, mid, bottom,
+    });
+}
+
+// a full screen does not fit in main_cells, the rows that do not come
+// back as lost text until they are drawn over
+static void test_alt_screen()
+{
+    reset();
+    for (int r = 0; r < grid_rows; r++) {
+        send("\x1B[" + std::to_string(r + 1) + ";1H" + std::string(grid_cols, 'a' + r % 26));
+    }
+    send("\x1B[5;7H\x1B[?1049h");
+    expect_screen("alternate screen", {});
+    send("on the alternate screen\x1B[?1049l");
+    assert(cursor_row == 4 && cursor_col == 6);
+
+    uint16_t kept = MAIN_CELLS_SIZE / (grid_cols + 1);
+    std::vector<std::string> screen;
+    for (int r = 0; r < grid_rows; r++) {
+        screen.push_back(std::string(grid_cols, r < kept ? 'a' + r % 26 : LOST_CELL));
+    }
+    expect_screen("main screen", screen);
+
+    send("\x1B[29;1H\x1B[2Kwritten over");
+    screen[28] = "written over";
+    expect_screen("lost row erased", screen);
+}
+
+// a key echoed while a host escape or UTF-8 sequence is half received
+// is shown where the cursor is, and the host sequence then carries on
+static void test_echo()
+{
+    reset();
+    send("\x1B[3;3Hab\x1B[");
+    echo_char('Z');
+    send("5;7Hcd\xE2\x94");
+    echo_char('Y');
+    send("\x80");
+
+    expect_screen("echo", { "", "", "  abZ", "", sp(6) + "cdY" + glyphs({ GLYPH_HLINE }) });
+}
+
+// a line of len characters that starts with its number
+static std::string numbered(int n, int len)
+{
+    std::string s = std::to_string(n) + ":";
+    while((int)s.size() < len) s += 'a' + s.size() % 26;
+    return s;
+}
+
+static void rotate(int r)
+{
+    tft.setRotation(r);
+    reflow_screen();
+}
+
+// wrapped rows are joined again and wrapped at the new width, and the
+// cursor stays on the same character
+static void test_reflow()
+{
+    reset();
+    std::string a = numbered(1, 150), b = "short line";
+    send(a + "\r\n" + b + "\r\nx\x1B[2;20H");
+
+    rotate(1);
+    assert(grid_cols == 60 && grid_rows == 50);
+    expect_screen("reflow to portrait", { a.substr(0, 60), a.substr(60, 60), a.substr(120), b, "x" });
+    assert(cursor_row == 1 && cursor_col == 59);
+
+    rotate(0);
+    assert(grid_cols == 100 && grid_rows == 30);
+    expect_screen("reflow to landscape", { a.substr(0, 100), a.substr(100), b, "x" });
+    assert(cursor_row == 1 && cursor_col == 19);
+}
+
+// text that no longer fits loses its top lines, those nearest the cursor
+// at the end are kept, and it comes back to landscape a line to a row
+static void test_reflow_overflow()
+{
+    reset();
+    for (int i = 1; i <= grid_rows; i++) {
+        send(numbered(i, 99) + (i < grid_rows ? "\r\n" : ""));
+    }
+    assert(cursor_row == 29 && cursor_col == 99);
+
+    // each line takes two rows, so the last 25 are kept
+    rotate(1);
+    std::vector<std::string> screen;
+    for (int i = 6; i <= 30; i++) {
+        screen.push_back(numbered(i, 99).substr(0, 60));
+        screen.push_back(numbered(i, 99).substr(60));
+    }
+    expect_screen("overflow in portrait", screen);
+    assert(cursor_row == 49 && cursor_col == 39);
+
+    rotate(0);
+    screen.clear();
+    for (int i = 6; i <= 30; i++) screen.push_back(numbered(i, 99));
+    expect_screen("back to landscape", screen);
+    assert(cursor_row == 24 && cursor_col == 99);
+}
+
+#ifdef SPLIT
+// the settings menu repaints all of a new layout
+static void set_split(uint8_t s)
+{
+    render_flush();
+    split = s;
+    set_geometry();
+    memset(tft.shown, ' ', sizeof(tft.shown));
+    for (uint16_t r = 0; r < grid_rows; r++) memcpy(tft.shown[r], &screen_cells[r * grid_cols], grid_cols);
+}
+
+// a row of the side by side panes
+static std::string beside(const std::string& left, const std::string& right)
+{
+    return left + sp(49 - left.size()) + glyphs({ GLYPH_VLINE }) + right;
+}
+
+// Scrolling the left pane moves the dirty spans of its half of the rows,
+// the right pane keeps those of its own half. Clearing the screen and the
+// alternate screen only clear the pane.
+static void test_split_beside()
+{
+    set_split(2);
+    assert(screen_cols == 49 && screen_rows == 30);
+
+    switch_session(1);
+    send("\x1B[2;1Hright pane row 2");
+    switch_session(0);
+    for (int i = 1; i <= 10; i++) send(numbered(i, 40) + "\r\n");
+    expect_shown("before the scroll");
+
+    // the right pane's text on rows the left pane scrolls is not drawn yet
+    switch_session(1);
+    send("\x1B[20;5Hright 20\x1B[30;1Hright 30");
+    switch_session(0);
+    for (int i = 11; i <= 35; i++) send(numbered(i, 40) + "\r\n");
+
+    std::vector<std::string> screen;
+    for (int i = 7; i <= 35; i++) screen.push_back(beside(numbered(i, 40), ""));
+    screen.push_back(beside("", ""));
+    screen[1] = beside(numbered(8, 40), "right pane row 2");
+    screen[19] = beside(numbered(26, 40), "    right 20");
+    screen[29] = beside("", "right 30");
+    expect_screen("left pane scrolled", screen);
+    expect_shown("left pane scrolled");
+
+    switch_session(1);
+    send("\x1B[2J");
+    assert(cursor_col == 8 && cursor_row == 29);
+    for (auto& row : screen) row = row.substr(0, 50);
+    expect_screen("right pane cleared", screen);
+    expect_shown("right pane cleared");
+
+    send("\x1B[3;3H\x1B[?1049hon alt");
+    screen[0] = beside(numbered(7, 40), "on alt");
+    expect_screen("alternate screen in a pane", screen);
+    send("\x1B[?1049l");
+    assert(cursor_col == 2 && cursor_row == 2);
+    screen[0] = beside(numbered(7, 40), "");
+    expect_screen("main screen in a pane", screen);
+    expect_shown("main screen in a pane");
+
+    switch_session(0);
+    set_split(0);
+}
+
+// the lower pane scrolls its own rows, below the line between the panes
+static void test_split_stacked()
+{
+    set_split(1);
+    assert(screen_cols == 100 && screen_rows == 14);
+
+    send("upper pane");
+    switch_session(1);
+    for (int i = 1; i <= 20; i++) send("\r\n" + numbered(i, 90));
+    switch_session(0);
+
+    std::vector<std::string> screen = { "upper pane" };
+    screen.resize(14);
+    screen.push_back(std::string(100, (char)GLYPH_HLINE));
+    for (int i = 6; i <= 20; i++) screen.push_back(numbered(i, 90));
+    expect_screen("lower pane scrolled", screen);
+    expect_shown("lower pane scrolled");
+
+    set_split(0);
+}
+#endif
+
+int main()
+{
+    // what failed is printed before the assert aborts
+    setvbuf(stdout, NULL, _IONBF, 0);
+    set_geometry();
+    assert(grid_cols == 100 && grid_rows == 30);
+
+    test_text_and_erase();
+    test_cursor_moves();
+    test_autowrap();
+    test_glyphs();
+    test_alt_screen();
+    test_echo();
+    test_reflow();
+    test_reflow_overflow();
+#ifdef SPLIT
+    test_split_beside();
+    test_split_stacked();
+    printf("cells with SPLIT: ok\n");
+#else
+    printf("cells: ok\n");
+#endif
+    return 0;
+}
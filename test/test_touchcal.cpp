@@ -0,0 +1,141 @@
+// Host test of the touch calibration maths in touchcal.cpp: the three
+// point fit, rejection of unusable points, the Q14 rounding and median3
+
+#define USETOUCH
+#include "../src/touchcal.cpp"
+
+#include <assert.h>
+#include <math.h>
+
+uint32_t millis() { return 0; }
+uint32_t micros() { return 0; }
+
+// one unfiltered sample through the transform
+static void map(uint16_t rx, uint16_t ry, int16_t& x, int16_t& y)
+{
+    touch_filter_reset();
+    touch_transform(rx, ry, x, y);
+}
+
+static void test_median3()
+{
+    const int16_t v[6][3] = { {1, 2, 3}, {1, 3, 2}, {2, 1, 3}, {2, 3, 1}, {3, 1, 2}, {3, 2, 1} };
+    for (int i = 0; i < 6; i++) assert(median3(v[i][0], v[i][1], v[i][2]) == 2);
+    assert(median3(5, 5, -1) == 5);
+    assert(median3(-7, -7, -7) == -7);
+}
+
+// raw points that are the targets themselves give the identity exactly
+static void test_identity()
+{
+    cal_point_t raw[3];
+    memcpy(raw, cal_targets, sizeof(raw));
+    assert(touch_cal_compute(raw));
+    assert(cal_a == 1 << CAL_SHIFT && cal_b == 0 && cal_c == 0);
+    assert(cal_d == 0 && cal_e == 1 << CAL_SHIFT && cal_f == 0);
+
+    int16_t x, y;
+    for (uint16_t ry = 0; ry < 480; ry += 7) {
+        for (uint16_t rx = 0; rx < 800; rx += 13) {
+            map(rx, ry, x, y);
+            assert(x == rx && y == ry);
+        }
+    }
+}
+
+// a panel that is scaled, mirrored and slightly rotated against the display
+static void panel(double x, double y, double& rx, double& ry)
+{
+    rx = 3900 - 4.6 * x + 0.08 * y;
+    ry = 150 + 0.05 * x + 7.9 * y;
+}
+
+// touching the targets of such a panel maps back onto them, and anywhere
+// else lands within the rounding of the Q14 coefficients, a pixel
+static void test_round_trip()
+{
+    cal_point_t raw[3];
+    for (int i = 0; i < 3; i++) {
+        double rx, ry;
+        panel(cal_targets[i].x, cal_targets[i].y, rx, ry);
+        raw[i].x = lround(rx);
+        raw[i].y = lround(ry);
+    }
+    assert(touch_cal_compute(raw));
+
+    int16_t x, y;
+    for (int i = 0; i < 3; i++) {
+        map(raw[i].x, raw[i].y, x, y);
+        assert(abs(x - cal_targets[i].x) <= 1 && abs(y - cal_targets[i].y) <= 1);
+    }
+    for (int16_t py = 0; py < 480; py += 16) {
+        for (int16_t px = 0; px < 800; px += 16) {
+            double rx, ry;
+            panel(px, py, rx, ry);
+            map(lround(rx), lround(ry), x, y);
+            assert(abs(x - px) <= 1 && abs(y - py) <= 1);
+        }
+    }
+}
+
+// points in a line, or so close together that the scale would overflow the
+// Q14 products, are refused and the previous calibration is kept
+static void test_degenerate()
+{
+    cal_point_t raw[3];
+    memcpy(raw, cal_targets, sizeof(raw));
+    assert(touch_cal_compute(raw));
+
+    const cal_point_t line[3] = { {100, 100}, {200, 200}, {300, 300} };
+    const cal_point_t same[3] = { {2000, 2000}, {2000, 2000}, {2000, 2000} };
+    const cal_point_t close[3] = { {2000, 2000}, {2010, 2003}, {2004, 2012} };
+    assert(!touch_cal_compute(line));
+    assert(!touch_cal_compute(same));
+    assert(!touch_cal_compute(close));
+
+    int16_t x, y;
+    map(123, 321, x, y);
+    assert(x == 123 && y == 321);
+}
+
+// the coefficients are truncated to Q14 and the result is floored, so a
+// half scale panel maps both raw values of a pixel onto it
+static void test_q14_rounding()
+{
+    cal_point_t raw[3];
+    for (int i = 0; i < 3; i++) {
+        raw[i].x = cal_targets[i].x * 2;
+        raw[i].y = cal_targets[i].y * 2;
+    }
+    assert(touch_cal_compute(raw));
+    assert(cal_a == 1 << (CAL_SHIFT - 1) && cal_e == 1 << (CAL_SHIFT - 1));
+
+    int16_t x, y;
+    for (uint16_t r = 0; r < 1600; r++) {
+        map(r, r * 3 / 5, x, y);
+        assert(x == r / 2 && y == r * 3 / 5 / 2);
+    }
+
+    // a scale of a third is not exact in Q14, it may be a pixel short but
+    // never over
+    for (int i = 0; i < 3; i++) {
+        raw[i].x = cal_targets[i].x * 3;
+        raw[i].y = cal_targets[i].y * 3;
+    }
+    assert(touch_cal_compute(raw));
+    for (uint16_t r = 0; r < 2400; r++) {
+        map(r, r, x, y);
+        assert(x <= r / 3 && x >= r / 3 - 1);
+    }
+}
+
+int main()
+{
+    test_median3();
+    test_identity();
+    test_round_trip();
+    test_degenerate();
+    test_q14_rounding();
+    printf("touchcal: ok\n");
+    return 0;
+}